@@ -1,4 +1,9 @@
 #include "Application.hpp"
+#include "Project.hpp"
+#include "Snapshot.hpp"
+#include "Stats.hpp"
+#include "TextureUpload.hpp"
+#include "ThreadPool.hpp"
 #include "fonts/MaterialIcons.hpp"
 #include "fonts/MaterialIconsFont.hpp"
 #include "fonts/OpenSansFont.hpp"
@@ -7,13 +12,19 @@
 #endif
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <filesystem>
 #include <stdexcept>
+#include <thread>
 
 #include <portable-file-dialogs.hpp>
 
 using namespace ayin;
 
+// Event pushed by wake(); registered at startup.
+static std::atomic<Uint32> wake_event = (Uint32)-1;
+
 Application::Application(const std::string &title) {
 	if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_TIMER) < 0) {
 		throw std::runtime_error(SDL_GetError());
@@ -68,6 +79,8 @@ Application::Application(const std::string &title) {
 		throw std::runtime_error(SDL_GetError());
 	};
 	SDL_GL_SetSwapInterval(1);
+	wake_event = SDL_RegisterEvents(1);
+	TextureUpload::init();
 
 	IMGUI_CHECKVERSION();
 	ImGui::CreateContext();
@@ -97,23 +110,34 @@ Application::Application(const std::string &title) {
 }
 
 Application::~Application() {
+	wait_for_jobs();
+	TextureUpload::shutdown();
 	ImGui_ImplOpenGL3_Shutdown();
 	ImGui_ImplSDL2_Shutdown();
 	ImGui::DestroyContext(NULL);
 
+	wake_event = (Uint32)-1;
 	SDL_GL_DeleteContext(gl_context);
 	SDL_DestroyWindow(sdl_window);
 	SDL_Quit();
 }
 
 void Application::new_frame() {
+	Stats::begin_frame();
 	ImGui_ImplOpenGL3_NewFrame();
 	ImGui_ImplSDL2_NewFrame();
 	ImGui::NewFrame();
 }
 
-void Application::add_photo(const std::string &filepath) {
-	Image *image = new Image();
+bool Application::add_photo(const std::string &filepath, bool load) {
+	int width, height, channels;
+	bool project = Project::is_project(filepath);
+	if (!(project ? Project::info(filepath.c_str(), width, height, channels)
+				  : Image::info(filepath.c_str(), width, height, channels))) {
+		pfd::Notify("Error", "Could not open " + filepath, pfd::Icon::error);
+		return false;
+	}
+
 	std::string name = std::filesystem::path(filepath).filename().string();
 	std::ostringstream name_suffix;
 
@@ -124,22 +148,126 @@ void Application::add_photo(const std::string &filepath) {
 		name_suffix << " (" << name_suffix_i++ << ")";
 	}
 
-	image->load(filepath.c_str());
-	image->load_texture();
-
 	std::unique_ptr<Photo> photo = std::make_unique<Photo>();
-	photo->image = image;
-	photo->origImage = new Image(*image);
+	for (Image **image : {&photo->image, &photo->origImage}) {
+		*image = new Image();
+		(*image)->width = width;
+		(*image)->height = height;
+		(*image)->channels = channels;
+	}
 	photo->name = name + name_suffix.str();
 	photo->filepath = filepath;
+	if (load) {
+		load_photo(*photo);
+	}
 
 	photos.push_back(std::move(photo));
+	return true;
 }
 
-Photo *Application::get_selected_photo() { return photos[m_selectedPhotoIndex].get(); }
+void Application::load_photo(Photo &photo) {
+	if (photo.loaded() || photo.pending_load != nullptr) {
+		return;
+	}
+	auto load = std::make_shared<PendingLoad>();
+	photo.pending_load = load;
+	ThreadPool::global().submit([load, filepath = photo.filepath] {
+		if (load->cancelled) {
+			load->done = true;
+			return;
+		}
+		double start = Stats::now();
+		try {
+			if (Project::is_project(filepath)) {
+				// The image is shown as soon as it is loaded, while the original and the history are decoded.
+				auto project = std::make_unique<Project::Contents>();
+				bool ok = Project::load(filepath.c_str(), *project, [&](Project::Contents &contents) {
+					load->image = contents.image.release();
+					load->time = Stats::now() - start;
+					load->image_loaded = true;
+					wake();
+				});
+				if (ok) {
+					load->project = std::move(project);
+				}
+			} else {
+				auto image = std::make_unique<Image>();
+				if (image->load(filepath.c_str(), &load->progress)) {
+					load->image = image.release();
+				}
+			}
+		} catch (const std::exception &) {
+			// Out of memory for the file's dimensions; reported like any other file that cannot be opened.
+			if (!load->image_loaded) {
+				load->image = nullptr;
+			}
+		}
+		if (!load->image_loaded) {
+			load->time = Stats::now() - start;
+		}
+		load->done = true;
+		wake();
+	});
+}
 
-void Application::set_selected_photo(size_t index) {
-	m_selectedPhotoIndex = std::clamp(index, (size_t)0, (size_t)(photos.size() - 1));
+void Application::update_loads() {
+	if (!photos.empty()) {
+		// The selected photo first, so its decode is queued ahead of the prefetches.
+		size_t selected = std::min(m_selectedPhotoIndex, photos.size() - 1);
+		size_t first = selected - std::min<size_t>(selected, AYIN_APPLICATION_PREFETCH);
+		size_t last = std::min(photos.size() - 1, selected + AYIN_APPLICATION_PREFETCH);
+		load_photo(*photos[selected]);
+		for (size_t i = first; i <= last; ++i) {
+			load_photo(*photos[i]);
+		}
+	}
+
+	for (size_t i = 0; i < photos.size();) {
+		Photo &photo = *photos[i];
+		PendingLoad *pending = photo.pending_load.get();
+		if (pending != nullptr && pending->image_loaded && !photo.loaded()) {
+			// A project's image, shown while its history is still being decoded.
+			photo.finish_loading(pending->image, pending->time, true);
+			pending->image = nullptr;
+			request_frames();
+		}
+		if (pending == nullptr || !pending->done) {
+			++i;
+			continue;
+		}
+		std::shared_ptr<PendingLoad> load = std::move(photo.pending_load);
+		if (photo.loaded() ? load->project == nullptr : load->image == nullptr) {
+			pfd::Notify("Error", "Could not decode " + photo.filepath, pfd::Icon::error);
+			photos.erase(photos.begin() + i);
+			if (m_selectedPhotoIndex > i || m_selectedPhotoIndex >= photos.size()) {
+				m_selectedPhotoIndex = m_selectedPhotoIndex > 0 ? m_selectedPhotoIndex - 1 : 0;
+			}
+			continue;
+		}
+		if (!photo.loaded()) {
+			photo.finish_loading(load->image, load->time);
+			load->image = nullptr;
+		}
+		if (Project::Contents *project = load->project.get()) {
+			// Merge steps point into the project's images; move those into the cache and repoint them.
+			std::vector<std::pair<const Image *, const Image *>> moved;
+			for (auto &asset : project->assets) {
+				const Image *old = asset.get();
+				moved.emplace_back(old, assets.adopt(std::move(asset)));
+			}
+			for (Commands::Info &step : project->steps) {
+				for (auto &[old, cached] : moved) {
+					if (step.ty == Commands::Type_Merge && step.merge_image == old) {
+						step.merge_image = cached;
+						break;
+					}
+				}
+			}
+			photo.restore_history(project->original.release(), std::move(project->steps), project->undo_position);
+		}
+		request_frames();
+		++i;
+	}
 }
 
 void Application::open_file_dialog() {
@@ -155,24 +283,153 @@ void Application::save_file_dialog(Photo &photo) {
 	if (selection.empty()) {
 		return;
 	}
-	if (photo.image->save(selection.c_str())) {
-		pfd::Notify("Error: Save", "An error happened", pfd::Icon::error);
+	save_photo(photo, selection);
+}
+
+void Application::save_photo(Photo &photo, const std::string &filepath) {
+	if (photo.pending_save != nullptr) {
+		return;
+	}
+	auto save = std::make_shared<PendingSave>();
+	save->filepath = filepath;
+	save->image = std::make_unique<Image>(*photo.image);
+	save->version = photo.version();
+	if (Project::is_project(filepath)) {
+		save->original = std::make_unique<Image>(*photo.origImage);
+		save->steps = photo.history();
+		save->undo_position = photo.undo_position();
+	}
+	photo.pending_save = save;
+	ThreadPool::global().submit([save] {
+		if (save->original != nullptr) {
+			save->ok = Project::save(save->filepath.c_str(), *save->image, *save->original, save->steps,
+									 save->undo_position);
+		} else {
+			save->ok = save->image->save(save->filepath.c_str());
+		}
+		save->done = true;
+		wake();
+	});
+}
+
+void Application::update_saves() {
+	// Merge sources are freed once no history and no running save uses them any more.
+	bool released = false;
+	for (auto &photo : photos) {
+		released = photo->take_dropped_merges() || released;
+		if (photo->pending_save == nullptr || !photo->pending_save->done) {
+			continue;
+		}
+		released = released || !photo->pending_save->steps.empty();
+		std::shared_ptr<PendingSave> save = std::move(photo->pending_save);
+		if (!save->ok) {
+			pfd::Notify("Error: Save", "Could not write " + save->filepath, pfd::Icon::error);
+		} else if (save->filepath == photo->filepath) {
+			photo->finish_saving(*save);
+			released = photo->take_dropped_merges() || released;
+		}
+		request_frames();
+	}
+	size_t closedSaves = m_closedSaves.size();
+	m_closedSaves.erase(std::remove_if(m_closedSaves.begin(), m_closedSaves.end(),
+									   [](const std::shared_ptr<PendingSave> &save) { return save->done.load(); }),
+						m_closedSaves.end());
+	if (released || m_closedSaves.size() != closedSaves) {
+		release_assets();
+	}
+}
+
+void Application::close_photo(size_t index) {
+	if (photos[index]->pending_save != nullptr) {
+		m_closedSaves.push_back(std::move(photos[index]->pending_save));
+	}
+	photos.erase(photos.begin() + index);
+	if (m_selectedPhotoIndex > index || (m_selectedPhotoIndex == index && index > 0)) {
+		m_selectedPhotoIndex -= 1;
+	}
+	release_assets();
+}
+
+void Application::release_assets() {
+	std::vector<const Image *> used;
+	auto addSteps = [&](const std::vector<Commands::Info> &steps) {
+		for (const Commands::Info &step : steps) {
+			if (step.ty == Commands::Type_Merge && step.merge_image != nullptr) {
+				used.push_back(step.merge_image);
+			}
+		}
+	};
+	for (auto &photo : photos) {
+		addSteps(photo->history());
+		if (photo->pending_save != nullptr) {
+			addSteps(photo->pending_save->steps);
+		}
+	}
+	for (auto &save : m_closedSaves) {
+		addSteps(save->steps);
+	}
+	assets.release_unused(used);
+}
+
+void Application::wait_for_jobs() {
+	std::vector<std::shared_ptr<PendingLoad>> loads;
+	std::vector<std::shared_ptr<PendingSave>> saves = m_closedSaves;
+	for (auto &photo : photos) {
+		if (photo->pending_load != nullptr) {
+			photo->pending_load->cancelled = true;
+			loads.push_back(photo->pending_load);
+		}
+		if (photo->pending_save != nullptr) {
+			saves.push_back(photo->pending_save);
+		}
+	}
+	auto finished = [&] {
+		return std::all_of(loads.begin(), loads.end(), [](auto &load) { return load->done.load(); }) &&
+			   std::all_of(saves.begin(), saves.end(), [](auto &save) { return save->done.load(); });
+	};
+	while (!finished()) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+}
+
+void Application::wake() {
+	if (wake_event == (Uint32)-1) {
+		return;
 	}
+	SDL_Event event{};
+	event.type = wake_event;
+	SDL_PushEvent(&event);
 }
 
+void Application::request_frames(int frames) { m_busyFrames = std::max(m_busyFrames, frames); }
+
 InputRequest Application::handle_input() {
 	static bool zoomin = false;
 	static bool zoomout = false;
 	SDL_Event event;
 	Uint32 window_flags = SDL_GetWindowFlags(sdl_window);
-	while (SDL_PollEvent(&event)) {
+	bool waited = false;
+	if (zoomin || zoomout) {
+		request_frames(1);
+	}
+	if (m_busyFrames > 0) {
+		--m_busyFrames;
+	} else {
+		waited = SDL_WaitEventTimeout(&event, io->WantTextInput ? AYIN_APPLICATION_TEXT_INPUT_TIMEOUT
+																: AYIN_APPLICATION_IDLE_TIMEOUT);
+	}
+	while (waited || SDL_PollEvent(&event)) {
+		waited = false;
+		m_busyFrames = AYIN_APPLICATION_SETTLE_FRAMES;
 		ImGui_ImplSDL2_ProcessEvent(&event);
 		switch (event.type) {
 		case SDL_QUIT:
 			done = true;
 			break;
 		case SDL_KEYDOWN:
-			if (event.key.keysym.sym == SDLK_F11) {
+			if (event.key.keysym.sym == SDLK_F3) {
+				show_hud = !show_hud;
+			} else if (event.key.keysym.sym == SDLK_F11) {
 				if ((window_flags & SDL_WINDOW_FULLSCREEN_DESKTOP) == SDL_WINDOW_FULLSCREEN_DESKTOP) {
 					SDL_SetWindowFullscreen(sdl_window, 0);
 				} else {
@@ -182,9 +439,9 @@ InputRequest Application::handle_input() {
 				if (event.key.keysym.sym == SDLK_o) {
 					open_file_dialog();
 				} else if (event.key.keysym.sym == SDLK_w) {
-					photos.erase(photos.begin() + m_selectedPhotoIndex);
-					if (m_selectedPhotoIndex > 0)
-						m_selectedPhotoIndex -= 1;
+					if (!photos.empty()) {
+						close_photo(m_selectedPhotoIndex);
+					}
 				} else if (event.key.keysym.mod & KMOD_SHIFT && (event.key.keysym.sym == SDLK_s)) {
 					return InputRequest(InputRequest_SaveAs);
 				} else if (event.key.keysym.sym == SDLK_s) {
@@ -227,6 +484,186 @@ InputRequest Application::handle_input() {
 	return InputRequest(InputRequest_None);
 }
 
+static constexpr double MiB = 1024.0 * 1024.0;
+
+void Application::show_stats_window() {
+	if (!show_stats) {
+		return;
+	}
+	ImGui::SetNextWindowSize(ImVec2(320, 0), ImGuiCond_FirstUseEver);
+	if (ImGui::Begin("Statistics", &show_stats)) {
+		ImGui::SeparatorText("History");
+		ImGui::Text("Undo: %.2f ms (avg %.2f ms)", Stats::undo.last, Stats::undo.average());
+		ImGui::Text("Redo: %.2f ms (avg %.2f ms)", Stats::redo.last, Stats::redo.average());
+		ImGui::Text("Snapshots: %.1f / %.0f MiB", Snapshot::total_size() / MiB, Snapshot::budget / MiB);
+		ImGui::Text("In RAM: %.1f / %.0f MiB", Snapshot::resident_size() / MiB, Snapshot::resident_budget / MiB);
+		ImGui::Text("Spilled: %.1f MiB", (Snapshot::total_size() - Snapshot::resident_size()) / MiB);
+		ImGui::SeparatorText("Memory");
+		ImGui::Text("Resident: %.1f MiB", Stats::resident_size() / MiB);
+		ImGui::Text("Merge assets: %.1f MiB", assets.size() / MiB);
+		size_t pyramids = 0;
+		for (auto &photo : photos) {
+			pyramids += photo->pyramid.size();
+		}
+		ImGui::Text("Pyramids: %.1f MiB", pyramids / MiB);
+		size_t textures = 0, pixels = 0;
+		int suspended = 0;
+		for (auto &photo : photos) {
+			textures += photo->texture_size();
+			pixels += photo->pixel_size();
+			suspended += photo->suspended();
+		}
+		ImGui::Text("Photo pixels: %.1f / %.0f MiB", pixels / MiB, pixel_budget / MiB);
+		ImGui::Text("Photo textures: %.1f / %.0f MiB", textures / MiB, texture_budget / MiB);
+		ImGui::Text("Suspended photos: %d / %zu", suspended, photos.size());
+		ImGui::SeparatorText("Display");
+		ImGui::Text("Texture uploads: %.1f KiB/frame", Stats::last_upload_bytes / 1024.0);
+		ImGui::Text("Wakeups: %d/s", Stats::wakeups_per_second);
+		ImGui::SeparatorText("Input");
+		Stats::Input input = Stats::input();
+		ImGui::Text("Read: %.1f MiB in %.1f ms", input.bytes / MiB, input.read.total);
+		ImGui::Text("Decoded: %.1f MP in %.1f ms", input.decode.total_megapixels, input.decode.total);
+	}
+	ImGui::End();
+}
+
+void Application::show_hud_window(const Commands::Base *cmd) {
+	if (!show_hud) {
+		return;
+	}
+	const ImGuiWindowFlags flags = ImGuiWindowFlags_NoDecoration | ImGuiWindowFlags_AlwaysAutoResize |
+								   ImGuiWindowFlags_NoSavedSettings | ImGuiWindowFlags_NoFocusOnAppearing |
+								   ImGuiWindowFlags_NoNav;
+	ImGui::SetNextWindowPos(ImVec2(io->DisplaySize.x - 10.0f, 33.0f), ImGuiCond_Always, ImVec2(1.0f, 0.0f));
+	ImGui::SetNextWindowBgAlpha(0.75f);
+	if (!ImGui::Begin("Performance", &show_hud, flags)) {
+		ImGui::End();
+		return;
+	}
+
+	float frames = 0.0f, worst = 0.0f;
+	for (float time : Stats::frame_times) {
+		frames += time;
+		worst = std::max(worst, time);
+	}
+	int last = (Stats::frame_times_offset + AYIN_STATS_FRAME_HISTORY - 1) % AYIN_STATS_FRAME_HISTORY;
+	ImGui::Text("Frame: %.2f ms (avg %.2f, max %.2f), %d wakeups/s", Stats::frame_times[last],
+				frames / AYIN_STATS_FRAME_HISTORY, worst, Stats::wakeups_per_second);
+	ImGui::PlotLines("##Frame times", Stats::frame_times, AYIN_STATS_FRAME_HISTORY, Stats::frame_times_offset, nullptr,
+					 0.0f, std::max(worst, 1000.0f / 60.0f), ImVec2(360.0f, 48.0f));
+	ImGui::Text("Uploads: %.1f KiB in %.2f ms last frame", Stats::last_upload_bytes / 1024.0,
+				Stats::last_upload_time);
+	ImGui::Text("Preview: %.2f ms (avg %.2f ms)", Stats::preview.last, Stats::preview.average());
+	Stats::Input input = Stats::input();
+	ImGui::Text("Input: %.2f ms read, %.2f ms decode last file (%.1f MP/s)", input.read.last, input.decode.last,
+				input.decode.megapixels_per_second());
+
+	if (ImGui::BeginTable("Commands", 4, ImGuiTableFlags_SizingFixedFit)) {
+		ImGui::TableSetupColumn("Command");
+		ImGui::TableSetupColumn("Last ms");
+		ImGui::TableSetupColumn("Avg ms");
+		ImGui::TableSetupColumn("MP/s");
+		ImGui::TableHeadersRow();
+		for (int i = 0; i < Commands::number; ++i) {
+			const Stats::Timing &timing = command_timings[i];
+			if (timing.count == 0) {
+				continue;
+			}
+			ImGui::TableNextRow();
+			ImGui::TableNextColumn();
+			ImGui::TextUnformatted(Commands::names[i]);
+			ImGui::TableNextColumn();
+			ImGui::Text("%.2f", timing.last);
+			ImGui::TableNextColumn();
+			ImGui::Text("%.2f", timing.average());
+			ImGui::TableNextColumn();
+			ImGui::Text("%.1f", timing.megapixels_per_second());
+		}
+		ImGui::EndTable();
+	}
+
+	if (ImGui::BeginTable("Photos", 6, ImGuiTableFlags_SizingFixedFit)) {
+		ImGui::TableSetupColumn("Photo (MiB)");
+		ImGui::TableSetupColumn("Image");
+		ImGui::TableSetupColumn("Original");
+		ImGui::TableSetupColumn("History");
+		ImGui::TableSetupColumn("Previews");
+		ImGui::TableSetupColumn("Decode ms");
+		ImGui::TableHeadersRow();
+		Photo *selected = get_selected_photo();
+		for (auto &photo : photos) {
+			size_t image = 0, original = 0;
+			if (photo->ready()) {
+				image = (size_t)photo->image->width * photo->image->height * photo->image->channels;
+				original = (size_t)photo->origImage->width * photo->origImage->height * photo->origImage->channels;
+			}
+			size_t previews = photo->pyramid.size() + photo->texture_size();
+			if (cmd != nullptr && photo.get() == selected) {
+				previews += cmd->previewMemory();
+			}
+			ImGui::TableNextRow();
+			ImGui::TableNextColumn();
+			ImGui::TextUnformatted(photo->name.c_str());
+			ImGui::TableNextColumn();
+			ImGui::Text("%.1f", image / MiB);
+			ImGui::TableNextColumn();
+			ImGui::Text("%.1f", original / MiB);
+			ImGui::TableNextColumn();
+			ImGui::Text("%.1f", photo->history_size() / MiB);
+			ImGui::TableNextColumn();
+			ImGui::Text("%.1f", previews / MiB);
+			ImGui::TableNextColumn();
+			if (photo->loaded()) {
+				ImGui::Text("%.1f", photo->load_time());
+			} else {
+				ImGui::TextUnformatted("...");
+			}
+		}
+		ImGui::EndTable();
+	}
+	ImGui::End();
+}
+
+void Application::update_residency(bool allow_suspend) {
+	Photo *selected = get_selected_photo();
+	if (selected != nullptr && selected->suspended()) {
+		if (!selected->resume()) {
+			pfd::Notify("Error", "Could not restore " + selected->name, pfd::Icon::error);
+		}
+		request_frames();
+	}
+
+	size_t textures = 0, pixels = 0;
+	std::vector<Photo *> unseen;
+	for (auto &photo : photos) {
+		textures += photo->texture_size();
+		pixels += photo->pixel_size();
+		if (photo.get() != selected) {
+			unseen.push_back(photo.get());
+		}
+	}
+	if (textures <= texture_budget && pixels <= pixel_budget) {
+		return;
+	}
+	std::sort(unseen.begin(), unseen.end(), [](Photo *a, Photo *b) { return a->last_shown() < b->last_shown(); });
+	for (Photo *photo : unseen) {
+		if (textures <= texture_budget) {
+			break;
+		}
+		textures -= photo->texture_size();
+		photo->unload_textures();
+	}
+	for (Photo *photo : unseen) {
+		if (pixels <= pixel_budget || !allow_suspend) {
+			break;
+		}
+		if (photo->ready()) {
+			pixels -= photo->pixel_size();
+			photo->suspend();
+		}
+	}
+}
+
 void Application::render() {
 	ImGui::Render();
 	glViewport(0, 0, (int)io->DisplaySize.x, (int)io->DisplaySize.y);
@@ -236,4 +673,5 @@ void Application::render() {
 	glClear(GL_COLOR_BUFFER_BIT);
 	ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
 	SDL_GL_SwapWindow(sdl_window);
+	Stats::end_frame();
 }
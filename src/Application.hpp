@@ -1,7 +1,11 @@
 #pragma once
 
+#include "AssetCache.hpp"
 #include "Photo.hpp"
+#include "Project.hpp"
+#include "Stats.hpp"
 
+#include <array>
 #include <memory>
 #include <string>
 #include <vector>
@@ -18,10 +22,42 @@
 #endif
 #include <SDL2/SDL_opengl.h>
 
+#ifndef AYIN_APPLICATION_IDLE_TIMEOUT
+// Longest the main loop sleeps without events, in milliseconds.
+#define AYIN_APPLICATION_IDLE_TIMEOUT 1000
+#endif
+
+#ifndef AYIN_APPLICATION_TEXT_INPUT_TIMEOUT
+// Same while a text field is active, so its cursor keeps blinking.
+#define AYIN_APPLICATION_TEXT_INPUT_TIMEOUT 250
+#endif
+
+#ifndef AYIN_APPLICATION_SETTLE_FRAMES
+// Frames rendered after the last event before the loop sleeps again, giving ImGui time to settle its layout.
+#define AYIN_APPLICATION_SETTLE_FRAMES 3
+#endif
+
+#ifndef AYIN_APPLICATION_TEXTURE_BUDGET
+// Bytes of textures the photos may keep before unseen ones release theirs.
+#define AYIN_APPLICATION_TEXTURE_BUDGET ((size_t)1024 * 1024 * 1024)
+#endif
+
+#ifndef AYIN_APPLICATION_PIXEL_BUDGET
+// Bytes of uncompressed pixels the photos may keep before unseen ones are suspended.
+#define AYIN_APPLICATION_PIXEL_BUDGET ((size_t)2048 * 1024 * 1024)
+#endif
+
+#ifndef AYIN_APPLICATION_PREFETCH
+// Tabs on each side of the selected one whose photos are decoded ahead of being selected.
+#define AYIN_APPLICATION_PREFETCH 1
+#endif
+
 namespace ayin {
 
-const std::vector<std::string> pfdImageFile = {"All Picture Files (*.bmp;*.jpg;*.jpeg;*.png;*.psd)",
-											   "*.bmp *.dib *.jpg *.jpeg *.jpe *.jfif *.gif *.png *.psd"};
+const std::vector<std::string> pfdImageFile = {"All Picture Files (*.bmp;*.jpg;*.jpeg;*.png;*.psd;*.qoi;*.ppm;*.pam)",
+											   "*.bmp *.dib *.jpg *.jpeg *.jpe *.jfif *.gif *.png *.psd *.qoi *.ppm "
+											   "*.pgm *.pnm *.pam",
+											   "Ayin Projects (*.ayin)", "*" AYIN_PROJECT_EXTENSION};
 
 enum InputRequest_ {
 	InputRequest_ZoomIn,
@@ -44,24 +80,70 @@ struct InputRequest {
 
 class Application {
 public:
+	// Declared before photos so it outlives the history steps that point into it.
+	AssetCache assets{};
 	std::vector<std::unique_ptr<Photo>> photos;
 	ImGuiIO *io = nullptr;
 	bool done = false;
+	bool show_stats = false;
+	bool show_hud = false;
+	// Time spent applying each command, indexed by Commands::Type.
+	std::array<Stats::Timing, Commands::number> command_timings{};
+	size_t texture_budget = AYIN_APPLICATION_TEXTURE_BUDGET;
+	size_t pixel_budget = AYIN_APPLICATION_PIXEL_BUDGET;
 
 	Application(const std::string &title);
 	~Application();
 	void new_frame();
-	void add_photo(const std::string &filepath);
+	// Opens a tab for the file from its header alone. With load, decoding starts right away in the background;
+	// otherwise it waits until the tab is selected or prefetched. Returns false if the file is not an image.
+	bool add_photo(const std::string &filepath, bool load = true);
+	// Starts decoding a photo's file on the thread pool unless it is loaded or already being decoded.
+	void load_photo(Photo &photo);
+	// Starts decoding the selected photo and its AYIN_APPLICATION_PREFETCH neighbours, and installs the pixels of
+	// finished decodes, closing tabs whose file failed to decode.
+	void update_loads();
 	Photo *get_selected_photo();
 	void set_selected_photo(size_t index);
+	// Closes the tab of photos[index] and frees the Merge sources that only its history used. A save of the photo
+	// that is still running finishes first, and keeps what it writes alive until then.
+	void close_photo(size_t index);
 	void open_file_dialog();
 	void save_file_dialog(Photo &photo);
+	// Starts writing a copy of photo's image to filepath on the thread pool, unless a save of the photo is running.
+	void save_photo(Photo &photo, const std::string &filepath);
+	// Reports saves that failed. A successful save to the photo's own file makes the saved image the original, as
+	// long as the photo was not edited meanwhile. Also frees the Merge sources that histories dropped since the last
+	// call and that nothing else uses.
+	void update_saves();
+	void show_stats_window();
+	// Performance overlay toggled with F3: frame times, command and upload timings, and memory per photo. cmd is the
+	// command being edited on the selected photo, if any.
+	void show_hud_window(const Commands::Base *cmd);
+	// Resumes the selected photo if it is suspended, then brings the others within texture_budget and pixel_budget,
+	// least recently shown first. Call after render() so a suspended photo's placeholder is on screen while it is
+	// restored. Photos are only suspended when allow_suspend is set.
+	void update_residency(bool allow_suspend);
 	void render();
+	// Processes pending input. When nothing happened for a few frames, first sleeps until an event arrives.
 	InputRequest handle_input();
+	// Keeps the loop rendering for the next frames, e.g. while something animates.
+	void request_frames(int frames = AYIN_APPLICATION_SETTLE_FRAMES);
+	// Wakes a sleeping main loop. Safe to call from any thread, e.g. by workers that finished a job.
+	static void wake();
 
 private:
+	// Saves of closed photos that are still running.
+	std::vector<std::shared_ptr<PendingSave>> m_closedSaves{};
 	SDL_GLContext gl_context = nullptr;
 	SDL_Window *sdl_window = nullptr;
 	size_t m_selectedPhotoIndex = 0;
+	int m_busyFrames = AYIN_APPLICATION_SETTLE_FRAMES;
+
+	// Frees the assets that no photo's history and no running save points at.
+	void release_assets();
+	// Waits for the running saves and decodes, skipping the decodes that have not started, so none of them outlives
+	// the photos and assets it reads.
+	void wait_for_jobs();
 };
 } // namespace ayin
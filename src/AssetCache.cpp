@@ -0,0 +1,74 @@
+#include "AssetCache.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <system_error>
+
+using namespace ayin;
+
+// FNV-1a over 64-bit words, which is plenty to find the candidates and runs at memory speed.
+static uint64_t hash(const unsigned char *data, size_t size) {
+	uint64_t h = 0xcbf29ce484222325ull ^ size;
+	size_t i = 0;
+	for (; i + 8 <= size; i += 8) {
+		uint64_t word;
+		memcpy(&word, data + i, 8);
+		h = (h ^ word) * 0x100000001b3ull;
+	}
+	for (; i < size; ++i) {
+		h = (h ^ data[i]) * 0x100000001b3ull;
+	}
+	return h;
+}
+
+const Image *AssetCache::load(const std::string &filename) {
+	std::filesystem::path path = std::filesystem::u8path(filename);
+	std::error_code sizeError, timeError;
+	File file{std::filesystem::file_size(path, sizeError), std::filesystem::last_write_time(path, timeError), nullptr};
+	bool known = !sizeError && !timeError;
+	auto it = m_files.find(filename);
+	if (known && it != m_files.end() && it->second.size == file.size && it->second.time == file.time) {
+		return it->second.image;
+	}
+
+	auto image = std::make_unique<Image>();
+	if (!image->load(filename.c_str())) {
+		return nullptr;
+	}
+	file.image = adopt(std::move(image));
+	if (known) {
+		m_files[filename] = file;
+	}
+	return file.image;
+}
+
+const Image *AssetCache::adopt(std::unique_ptr<Image> image) {
+	size_t size = (size_t)image->width * image->height * image->channels;
+	uint64_t key = hash(image->data, size);
+	key ^= ((uint64_t)image->width << 40) ^ ((uint64_t)image->height << 16) ^ (uint64_t)image->channels;
+	auto [first, last] = m_images.equal_range(key);
+	for (auto it = first; it != last; ++it) {
+		const Image &cached = *it->second;
+		if (cached.width == image->width && cached.height == image->height && cached.channels == image->channels &&
+			memcmp(cached.data, image->data, size) == 0) {
+			return &cached;
+		}
+	}
+	m_size += size;
+	return m_images.emplace(key, std::move(image))->second.get();
+}
+
+void AssetCache::release_unused(const std::vector<const Image *> &used) {
+	for (auto it = m_images.begin(); it != m_images.end();) {
+		const Image *image = it->second.get();
+		if (std::find(used.begin(), used.end(), image) != used.end()) {
+			++it;
+			continue;
+		}
+		for (auto file = m_files.begin(); file != m_files.end();) {
+			file = file->second.image == image ? m_files.erase(file) : std::next(file);
+		}
+		m_size -= (size_t)image->width * image->height * image->channels;
+		it = m_images.erase(it);
+	}
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "Image.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace ayin {
+// Decoded images that commands read from disk (such as the second image of a Merge), stored once per distinct pixels:
+// a hash of the dimensions and pixels finds the candidates, which are compared in full. History steps point at the
+// entries and replay without touching the filesystem or the decoder, a file merged into several tabs is decoded only
+// once as long as it does not change, and the same image merged from a file and restored from a project is stored
+// once. Entries live until release_unused() finds no step that points at them.
+class AssetCache {
+public:
+	AssetCache() = default;
+	AssetCache(const AssetCache &) = delete;
+	AssetCache &operator=(const AssetCache &) = delete;
+
+	// Returns the decoded contents of filename, or nullptr if it cannot be read or decoded.
+	const Image *load(const std::string &filename);
+	// Takes ownership of already decoded pixels, such as the Merge images of a project file, and returns the cached
+	// image with the same pixels.
+	const Image *adopt(std::unique_ptr<Image> image);
+	// Frees the images that are not in used, which must hold every image still referenced.
+	void release_unused(const std::vector<const Image *> &used);
+	// Bytes held by decoded pixels.
+	size_t size() const { return m_size; }
+
+private:
+	// What a file looked like when it was decoded into image.
+	struct File {
+		uintmax_t size;
+		std::filesystem::file_time_type time;
+		const Image *image;
+	};
+
+	std::unordered_multimap<uint64_t, std::unique_ptr<Image>> m_images{};
+	std::unordered_map<std::string, File> m_files{};
+	size_t m_size = 0;
+};
+} // namespace ayin
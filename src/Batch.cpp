@@ -0,0 +1,193 @@
+#include "Batch.hpp"
+#include "Image.hpp"
+#include "Stats.hpp"
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <exception>
+#include <filesystem>
+#include <mutex>
+#include <system_error>
+
+using namespace ayin;
+
+namespace fs = std::filesystem;
+
+namespace {
+// Extensions of the files a directory contributes to a batch.
+const char *const ImageExtensions[] = {".bmp", ".gif", ".hdr", ".jpeg", ".jpg", ".pam", ".pgm", ".pic",
+									   ".png", ".pnm", ".ppm", ".psd", ".qoi", ".tga"};
+
+bool IsImageFile(const fs::path &path) {
+	std::string extension = path.extension().u8string();
+	std::transform(extension.begin(), extension.end(), extension.begin(), [](char c) { return (char)tolower(c); });
+	return std::find(std::begin(ImageExtensions), std::end(ImageExtensions), extension) != std::end(ImageExtensions);
+}
+
+// Matches name against pattern, where * stands for any run of characters and ? for any one.
+bool Match(const char *pattern, const char *name) {
+	const char *star = nullptr, *resume = nullptr;
+	while (*name) {
+		if (*pattern == '*') {
+			star = pattern++;
+			resume = name;
+		} else if (*pattern == '?' || *pattern == *name) {
+			++pattern;
+			++name;
+		} else if (star != nullptr) {
+			pattern = star + 1;
+			name = ++resume;
+		} else {
+			return false;
+		}
+	}
+	while (*pattern == '*') {
+		++pattern;
+	}
+	return *pattern == '\0';
+}
+
+size_t FileSize(const std::string &filename) {
+	std::error_code ec;
+	uintmax_t size = fs::file_size(fs::u8path(filename), ec);
+	return ec ? 0 : (size_t)size;
+}
+
+// Loads item.input, runs commands on it and saves it to item.output, adding what it did to summary.
+bool Process(const Batch::Item &item, const std::vector<Commands::Info> &commands, bool report,
+			 Batch::Summary &summary) {
+	double start = Stats::now();
+	Image image;
+	if (!image.load(item.input.c_str())) {
+		fprintf(stderr, "[ERROR] could not open %s\n", item.input.c_str());
+		return false;
+	}
+	double megapixels = (double)image.width * image.height / 1e6;
+	std::string line = item.input + ": " + std::to_string(image.width) + "x" + std::to_string(image.height);
+	char timing[96];
+	snprintf(timing, sizeof(timing), ", load %.1f ms", Stats::now() - start);
+	line += timing;
+
+	for (const Commands::Info &info : commands) {
+		Rect bounds{0, 0, image.width, image.height};
+		if (info.ty == Commands::Type_Crop &&
+			!bounds.contains(Rect{info.crop_x, info.crop_y, info.crop_width, info.crop_height})) {
+			fprintf(stderr, "[ERROR] crop goes outside the %dx%d image %s\n", image.width, image.height,
+					item.input.c_str());
+			return false;
+		}
+		double opStart = Stats::now();
+		Commands::apply(image, info);
+		snprintf(timing, sizeof(timing), ", %s %.1f ms", Commands::names[info.ty], Stats::now() - opStart);
+		line += timing;
+	}
+
+	double saveStart = Stats::now();
+	if (!image.save(item.output.c_str())) {
+		fprintf(stderr, "[ERROR] could not save %s\n", item.output.c_str());
+		return false;
+	}
+	double end = Stats::now();
+	snprintf(timing, sizeof(timing), ", save %.1f ms, total %.1f ms (%.1f MP/s)\n", end - saveStart, end - start,
+			 end > start ? megapixels / (end - start) * 1000.0 : 0.0);
+	line += timing;
+	if (report) {
+		fputs(line.c_str(), stdout);
+	}
+	summary.bytes_read += FileSize(item.input);
+	summary.bytes_written += FileSize(item.output);
+	summary.megapixels += megapixels;
+	return true;
+}
+} // namespace
+
+bool Batch::expand(const std::string &input, std::vector<std::string> &files) {
+	fs::path path = fs::u8path(input);
+	std::error_code ec;
+	std::vector<std::string> found;
+	std::string pattern = path.filename().u8string();
+	if (fs::is_directory(path, ec)) {
+		for (const fs::directory_entry &entry : fs::directory_iterator(path, ec)) {
+			if (entry.is_regular_file(ec) && IsImageFile(entry.path())) {
+				found.push_back(entry.path().u8string());
+			}
+		}
+	} else if (pattern.find_first_of("*?") != std::string::npos) {
+		fs::path directory = path.has_parent_path() ? path.parent_path() : fs::path(".");
+		for (const fs::directory_entry &entry : fs::directory_iterator(directory, ec)) {
+			if (entry.is_regular_file(ec) && Match(pattern.c_str(), entry.path().filename().u8string().c_str())) {
+				found.push_back(path.has_parent_path() ? entry.path().u8string()
+													   : entry.path().filename().u8string());
+			}
+		}
+	} else if (fs::exists(path, ec)) {
+		found.push_back(input);
+	}
+	std::sort(found.begin(), found.end());
+	files.insert(files.end(), found.begin(), found.end());
+	return !found.empty();
+}
+
+Batch::Summary Batch::run(const std::vector<Item> &items, const std::vector<Commands::Info> &commands,
+						  size_t memoryBudget, bool report) {
+	double start = Stats::now();
+	ThreadPool &pool = ThreadPool::global();
+	std::mutex mutex;
+	std::condition_variable cv;
+	size_t inFlight = 0, inFlightBytes = 0;
+	Summary summary;
+
+	auto process = [&](const Item &item, size_t cost) {
+		Summary done;
+		bool ok = false;
+		try {
+			ok = Process(item, commands, report, done);
+		} catch (const std::exception &exc) {
+			fprintf(stderr, "[ERROR] %s: %s\n", item.input.c_str(), exc.what());
+		}
+		std::lock_guard<std::mutex> lock(mutex);
+		summary.images += ok;
+		summary.failed += !ok;
+		summary.bytes_read += done.bytes_read;
+		summary.bytes_written += done.bytes_written;
+		summary.megapixels += done.megapixels;
+		--inFlight;
+		inFlightBytes -= cost;
+		cv.notify_all();
+	};
+
+	for (const Item &item : items) {
+		int width, height, channels;
+		size_t cost = 0;
+		if (Image::info(item.input.c_str(), width, height, channels)) {
+			cost = (size_t)width * height * channels * AYIN_BATCH_WORKING_SET_FACTOR;
+		}
+		// A file that does not fit alongside the others still runs, once nothing else does.
+		auto fits = [&] { return inFlight == 0 || inFlightBytes + cost <= memoryBudget; };
+		bool large = pool.size() <= 1 ? false : cost > memoryBudget / pool.size();
+
+		std::unique_lock<std::mutex> lock(mutex);
+		if (large) {
+			cv.wait(lock, fits);
+		} else {
+			cv.wait(lock, [&] { return inFlight < pool.size() && fits(); });
+		}
+		++inFlight;
+		inFlightBytes += cost;
+		lock.unlock();
+		if (large) {
+			process(item, cost);
+		} else {
+			pool.submit([&process, &item, cost] { process(item, cost); });
+		}
+	}
+
+	std::unique_lock<std::mutex> lock(mutex);
+	cv.wait(lock, [&] { return inFlight == 0; });
+	summary.ms = Stats::now() - start;
+	return summary;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "Commands.hpp"
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#ifndef AYIN_BATCH_MEMORY_BUDGET
+// Default bound, in bytes, on the memory of the images a batch has in flight at once.
+#define AYIN_BATCH_MEMORY_BUDGET ((size_t)2 * 1024 * 1024 * 1024)
+#endif
+
+#ifndef AYIN_BATCH_WORKING_SET_FACTOR
+// Memory a file takes while it is processed, in multiples of its decoded pixels: the image, the copy most filters
+// make of it, and the encoded output.
+#define AYIN_BATCH_WORKING_SET_FACTOR 3
+#endif
+
+// Runs the same commands over many files as a pipeline: each file is decoded, filtered and encoded by one job on the
+// thread pool, so files overlap each other's stages and every worker stays busy. A file is only started once the
+// estimated memory of the files in flight, including it, fits in the budget.
+//
+// The filters and codecs still split each file into tiles and strips, which idle workers pick up, but while there are
+// files enough for every worker each job mostly runs its own. Files too large for one worker's share of the budget run
+// on the calling thread instead, one at a time.
+namespace ayin::Batch {
+struct Item {
+	std::string input;
+	std::string output;
+};
+
+struct Summary {
+	size_t images = 0;
+	size_t failed = 0;
+	size_t bytes_read = 0;
+	size_t bytes_written = 0;
+	double megapixels = 0.0;
+	double ms = 0.0;
+};
+
+// Appends the files named by input to files: input itself if it is a file, the image files directly inside it if it
+// is a directory, or the files matching it if its last component has * or ? wildcards. Returns false if input names
+// nothing.
+bool expand(const std::string &input, std::vector<std::string> &files);
+// Loads each input, runs commands on it and saves it to its output, with failures reported on stderr. With report,
+// prints the time each file spent in every stage.
+Summary run(const std::vector<Item> &items, const std::vector<Commands::Info> &commands, size_t memoryBudget,
+			bool report);
+} // namespace ayin::Batch
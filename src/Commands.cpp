@@ -1,6 +1,16 @@
 #include "Commands.hpp"
 #include "Application.hpp"
 #include "ImageFilter.hpp"
+#include "Stats.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <climits>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
 
 #include <imgui.h>
 #include <portable-file-dialogs.hpp>
@@ -14,7 +24,7 @@ Info::Info(Type ty, int darkenlighten_factor) : ty(ty), darkenlighten_factor(dar
 Info::Info(Type ty, int frame_fanciness, unsigned int frame_color)
 	: ty(ty), frame_fanciness(frame_fanciness), frame_color(frame_color) {}
 
-Info::Info(Type ty, const char *merge_image) : ty(ty), merge_image(merge_image) {}
+Info::Info(Type ty, const Image *merge_image) : ty(ty), merge_image(merge_image) {}
 
 Info::Info(Type ty, int crop_x, int crop_y, int crop_width, int crop_height)
 	: ty(ty), crop_x(crop_x), crop_y(crop_y), crop_width(crop_width), crop_height(crop_height) {}
@@ -22,11 +32,479 @@ Info::Info(Type ty, int crop_x, int crop_y, int crop_width, int crop_height)
 Info::Info(Type ty, int resize_width, int resize_height)
 	: ty(ty), resize_width(resize_width), resize_height(resize_height) {}
 
-Base::~Base() { delete tmpImage; }
+bool Info::has_inverse() const {
+	switch (ty) {
+	case Type_Invert:
+	case Type_FlipHorizontally:
+	case Type_FlipVertically:
+	case Type_Rotate:
+		return true;
+	default:
+		return false;
+	}
+}
+
+Info Info::inverse() const {
+	if (ty == Type_Rotate) {
+		return Info(Type_Rotate, -rotate_turns);
+	}
+	return *this;
+}
+
+double Info::estimated_cost(int width, int height) const {
+	// Approximate nanoseconds per pixel; only the relative order matters much.
+	double perPixel = 2.0;
+	switch (ty) {
+	case Type_Merge:
+		perPixel = 20.0; // includes decoding the merged file
+		break;
+	case Type_DetectEdges:
+	case Type_Emboss:
+		perPixel = 15.0;
+		break;
+	case Type_Resize:
+	case Type_Skew:
+	case Type_Rotate:
+		perPixel = 5.0;
+		break;
+	case Type_Blur:
+		perPixel = 3.0 * (2 * blur_level + 1) * (2 * blur_level + 1);
+		break;
+	case Type_MotionBlur:
+		perPixel = 3.0 * (2 * blur_level + 1);
+		break;
+	case Type_OilPaint:
+		perPixel = 600.0;
+		break;
+	default:
+		break;
+	}
+	return perPixel * width * height / 1e6;
+}
+
+void ayin::Commands::apply(Image &image, const Info &cmd) {
+	switch (cmd.ty) {
+	case Type_Grayscale:
+		ImageFilter::Grayscale(image);
+		break;
+	case Type_BlackAndWhite:
+		ImageFilter::BlackAndWhite(image);
+		break;
+	case Type_Invert:
+		ImageFilter::Invert(image);
+		break;
+	case Type_Merge:
+		if (cmd.merge_image != nullptr) {
+			ImageFilter::Merge(image, *cmd.merge_image);
+		}
+		break;
+	case Type_FlipHorizontally:
+		ImageFilter::FlipHorizontally(image);
+		break;
+	case Type_FlipVertically:
+		ImageFilter::FlipVertically(image);
+		break;
+	case Type_Rotate:
+		if (cmd.rotate_turns < 0) {
+			ImageFilter::RotateCounterClockwise(image);
+		} else {
+			ImageFilter::Rotate(image);
+		}
+		break;
+	case Type_DarkenAndLighten:
+		ImageFilter::ChangeBrightness(image, cmd.darkenlighten_factor);
+		break;
+	case Type_Crop:
+		ImageFilter::Crop(image, cmd.crop_x, cmd.crop_y, cmd.crop_width, cmd.crop_height);
+		break;
+	case Type_Frame:
+		ImageFilter::Frame(image, cmd.frame_fanciness, cmd.frame_color);
+		break;
+	case Type_DetectEdges:
+		ImageFilter::DetectEdges(image);
+		break;
+	case Type_Resize:
+		ImageFilter::Resize(image, cmd.resize_width, cmd.resize_height);
+		break;
+	case Type_Blur:
+		ImageFilter::Blur(image, cmd.blur_level);
+		break;
+	case Type_Sunlight:
+		ImageFilter::Sunlight(image);
+		break;
+	case Type_OilPaint:
+		ImageFilter::OilPaint(image);
+		break;
+	case Type_Purple:
+		ImageFilter::Purple(image);
+		break;
+	case Type_Infrared:
+		ImageFilter::Infrared(image);
+		break;
+	case Type_Skew:
+		ImageFilter::Skew(image, cmd.skew_angle);
+		break;
+	case Type_Glasses3D:
+		ImageFilter::Glasses3D(image, cmd.darkenlighten_factor);
+		break;
+	case Type_MotionBlur:
+		ImageFilter::MotionBlur(image, cmd.blur_level);
+		break;
+	case Type_Emboss:
+		ImageFilter::Emboss(image);
+		break;
+	}
+}
+
+namespace {
+// Lowercase letters and digits of name, so that spellings of a command name compare equal.
+std::string Normalize(const std::string &name) {
+	std::string normalized;
+	for (char c : name) {
+		if (isalnum((unsigned char)c)) {
+			normalized += (char)tolower((unsigned char)c);
+		}
+	}
+	return normalized;
+}
+
+int ParseInt(const std::string &text, const std::string &spec) {
+	size_t end = 0;
+	int value = 0;
+	try {
+		value = std::stoi(text, &end);
+	} catch (const std::exception &) {
+		end = 0;
+	}
+	if (end == 0 || end != text.size()) {
+		throw std::invalid_argument("'" + text + "' is not a number in '" + spec + "'");
+	}
+	return value;
+}
+} // namespace
+
+Info ayin::Commands::parse(const std::string &spec, AssetCache &assets) {
+	size_t colon = spec.find(':');
+	std::string name = Normalize(spec.substr(0, colon));
+	std::string arguments = colon == std::string::npos ? "" : spec.substr(colon + 1);
+	int index = 0;
+	while (index < number && Normalize(names[index]) != name) {
+		++index;
+	}
+	if (index == number) {
+		throw std::invalid_argument("unknown operation '" + spec + "'");
+	}
+	Type ty = (Type)index;
+
+	if (ty == Type_Merge) {
+		if (arguments.empty()) {
+			throw std::invalid_argument("'" + spec + "' needs the image to merge, as merge:path");
+		}
+		const Image *mergeImage = assets.load(arguments);
+		if (mergeImage == nullptr) {
+			throw std::runtime_error("could not open " + arguments);
+		}
+		return Info(ty, mergeImage);
+	}
+
+	std::vector<std::string> args;
+	for (size_t begin = 0; !arguments.empty() && begin <= arguments.size();) {
+		size_t comma = std::min(arguments.find(',', begin), arguments.size());
+		args.push_back(arguments.substr(begin, comma - begin));
+		begin = comma + 1;
+	}
+	auto expect = [&](size_t min, size_t max) {
+		if (args.size() < min || args.size() > max) {
+			std::string count = min == max ? std::to_string(min) : std::to_string(min) + " to " + std::to_string(max);
+			throw std::invalid_argument("'" + spec + "' takes " + count + " arguments");
+		}
+	};
+	// Argument i, or fallback if it was left out, which must lie in [min, max].
+	auto arg = [&](size_t i, int fallback, int min, int max) {
+		int value = i < args.size() ? ParseInt(args[i], spec) : fallback;
+		if (value < min || value > max) {
+			throw std::invalid_argument("'" + args[i] + "' is out of range in '" + spec + "'");
+		}
+		return value;
+	};
+
+	switch (ty) {
+	case Type_Rotate: {
+		expect(0, 1);
+		int turns = arg(0, 1, -1, 1);
+		if (turns == 0) {
+			throw std::invalid_argument("'" + spec + "' turns 1 (clockwise) or -1 (counter-clockwise)");
+		}
+		return Info(ty, turns);
+	}
+	case Type_DarkenAndLighten:
+		expect(0, 1);
+		return Info(ty, arg(0, 100, 0, 1000));
+	case Type_Crop:
+		expect(4, 4);
+		return Info(ty, arg(0, 0, 0, INT_MAX), arg(1, 0, 0, INT_MAX), arg(2, 0, 1, INT_MAX), arg(3, 0, 1, INT_MAX));
+	case Type_Frame: {
+		expect(0, 2);
+		unsigned int color = 0xffffffff;
+		if (args.size() == 2) {
+			const std::string &hex = args[1][0] == '#' ? args[1].substr(1) : args[1];
+			if (hex.size() != 6 || !std::all_of(hex.begin(), hex.end(), [](char c) { return isxdigit(c) != 0; })) {
+				throw std::invalid_argument("'" + args[1] + "' is not an RRGGBB color in '" + spec + "'");
+			}
+			unsigned int rgb = (unsigned int)std::stoul(hex, nullptr, 16);
+			color = 0xff000000 | (rgb & 0xff) << 16 | (rgb & 0xff00) | rgb >> 16; // as ImGui packs colors
+		}
+		return Info(ty, arg(0, 1, 1, 3), color);
+	}
+	case Type_Resize:
+		expect(2, 2);
+		return Info(ty, arg(0, 0, 1, 1 << 16), arg(1, 0, 1, 1 << 16));
+	case Type_Blur:
+		expect(0, 1);
+		return Info(ty, arg(0, 5, 1, 100));
+	case Type_Skew:
+		expect(0, 1);
+		return Info(ty, arg(0, 45, -89, 89));
+	case Type_Glasses3D:
+		expect(0, 1);
+		return Info(ty, arg(0, 10, 0, 1000));
+	case Type_MotionBlur:
+		expect(0, 1);
+		return Info(ty, arg(0, 9, 1, 100));
+	default:
+		expect(0, 0);
+		return Info(ty);
+	}
+}
+
+Base::~Base() {
+	delete tmpImage;
+	delete proxyImage;
+}
+
+void Base::setZoom(float zoom) {
+	m_targetScale = std::min(zoom, 1.0f);
+	if (image == nullptr || tmpImage == nullptr) {
+		return;
+	}
+	// Rebuild only on large changes so zooming does not recompute the preview every frame.
+	if (m_targetScale > previewScale * 1.25f || m_targetScale < previewScale * 0.5f) {
+		makeProxy();
+		updatePreview();
+	}
+}
+
+ImVec2 Base::previewSize(float zoom) const {
+	return ImVec2(tmpImage->width / previewScale * zoom, tmpImage->height / previewScale * zoom);
+}
+
+void Base::makeProxy() {
+	delete proxyImage;
+	proxyImage = nullptr;
+	previewScale = 1.0f;
+	m_restore.clear();
+	int width = std::max(1, (int)std::lround(image->width * m_targetScale));
+	int height = std::max(1, (int)std::lround(image->height * m_targetScale));
+	if (width >= image->width || height >= image->height) {
+		return;
+	}
+	proxyImage = new Image(width, height, image->channels);
+	const Image &source = pyramid ? pyramid->level(*image, Pyramid::level_for_scale(m_targetScale)) : *image;
+	ImageFilter::Downscale(source, *proxyImage);
+	previewScale = (float)width / image->width;
+}
+
+void Base::beginPreview(Image &image) {
+	this->image = &image;
+	makeProxy();
+	updatePreview();
+}
+
+// Largest share of the image a partial preview may cover before computing the whole image is simpler.
+static const float maxPartialPreview = 0.6f;
+
+void Base::setViewport(Rect viewport) {
+	m_viewport = viewport;
+	if (tmpImage == nullptr || halo(previewScale) < 0) {
+		return;
+	}
+	Rect visible = visibleRegion();
+	if (!m_region.contains(visible)) {
+		extendRegion(visible.expand(visible.width / 4, visible.height / 4));
+	}
+}
+
+bool Base::isPreviewPartial() const {
+	const Image &source = proxyImage ? *proxyImage : *image;
+	return m_region.x != 0 || m_region.y != 0 || m_region.width != source.width || m_region.height != source.height;
+}
+
+size_t Base::previewMemory() const {
+	size_t size = 0;
+	for (const Image *preview : {tmpImage, proxyImage}) {
+		if (preview != nullptr) {
+			size += (size_t)preview->width * preview->height * preview->channels;
+		}
+	}
+	return size;
+}
+
+ImVec2 Base::previewOffset(float zoom) const {
+	return ImVec2(m_region.x / previewScale * zoom, m_region.y / previewScale * zoom);
+}
+
+// The viewport in preview source pixels, clamped to the source.
+ayin::Rect Base::visibleRegion() const {
+	const Image &source = proxyImage ? *proxyImage : *image;
+	Rect whole{0, 0, source.width, source.height};
+	if (m_viewport.empty()) {
+		return whole;
+	}
+	int x0 = (int)std::floor(m_viewport.x * previewScale);
+	int y0 = (int)std::floor(m_viewport.y * previewScale);
+	int x1 = (int)std::ceil((m_viewport.x + m_viewport.width) * previewScale);
+	int y1 = (int)std::ceil((m_viewport.y + m_viewport.height) * previewScale);
+	return Rect{x0, y0, x1 - x0, y1 - y0}.intersect(whole);
+}
+
+// Runs the filter over rect of the preview source (with its halo) and stores the result at targetRect of target.
+void Base::computeRect(Rect rect, Image &target, Rect targetRect) {
+	const Image &source = proxyImage ? *proxyImage : *image;
+	int h = halo(previewScale);
+	Rect input = rect.expand(h, h).intersect(Rect{0, 0, source.width, source.height});
+	Image tile(input.width, input.height, source.channels);
+	for (int j = 0; j < input.height; ++j) {
+		memcpy(&tile(0, j, 0), &source(input.x, input.y + j, 0), input.width * source.channels);
+	}
+	filter(tile, previewScale);
+	for (int j = 0; j < rect.height; ++j) {
+		memcpy(&target(targetRect.x, targetRect.y + j, 0), &tile(rect.x - input.x, rect.y - input.y + j, 0),
+			   rect.width * source.channels);
+	}
+}
+
+// Makes tmpImage hold region, keeping what it already has and computing only the rest.
+void Base::extendRegion(Rect region) {
+	const Image &source = proxyImage ? *proxyImage : *image;
+	region = region.intersect(Rect{0, 0, source.width, source.height});
+	if ((float)region.width * region.height > maxPartialPreview * source.width * source.height) {
+		updatePreview();
+		return;
+	}
+	Stats::Timer timer(Stats::preview);
+
+	Image *result = new Image(region.width, region.height, source.channels);
+	Rect kept = region.intersect(m_region);
+	std::vector<Rect> missing;
+	if (kept.empty()) {
+		missing.push_back(region);
+	} else {
+		for (int j = 0; j < kept.height; ++j) {
+			memcpy(&(*result)(kept.x - region.x, kept.y - region.y + j, 0),
+				   &(*tmpImage)(kept.x - m_region.x, kept.y - m_region.y + j, 0), kept.width * source.channels);
+		}
+		int bottom = kept.y + kept.height, right = kept.x + kept.width;
+		missing.push_back(Rect{region.x, region.y, region.width, kept.y - region.y});
+		missing.push_back(Rect{region.x, bottom, region.width, region.y + region.height - bottom});
+		missing.push_back(Rect{region.x, kept.y, kept.x - region.x, kept.height});
+		missing.push_back(Rect{right, kept.y, region.x + region.width - right, kept.height});
+	}
+	for (const Rect &rect : missing) {
+		if (!rect.empty()) {
+			computeRect(rect, *result, Rect{rect.x - region.x, rect.y - region.y, rect.width, rect.height});
+		}
+	}
+
+	delete tmpImage;
+	tmpImage = result;
+	tmpImage->load_texture();
+	m_region = region;
+	m_restore.clear();
+}
+
+void Base::updatePreview() {
+	const Image &source = proxyImage ? *proxyImage : *image;
+	if (halo(previewScale) >= 0) {
+		Rect visible = visibleRegion();
+		Rect region = visible.expand(visible.width / 4, visible.height / 4);
+		region = region.intersect(Rect{0, 0, source.width, source.height});
+		if ((float)region.width * region.height <= maxPartialPreview * source.width * source.height) {
+			m_region = Rect{};
+			extendRegion(region);
+			return;
+		}
+	}
+
+	Stats::Timer timer(Stats::preview);
+	m_region = Rect{0, 0, source.width, source.height};
+	int textureWidth = tmpImage ? tmpImage->width : 0;
+	int textureHeight = tmpImage ? tmpImage->height : 0;
+	bool whole = m_restore.empty();
+	if (tmpImage == nullptr || tmpImage->width != source.width || tmpImage->height != source.height) {
+		delete tmpImage;
+		tmpImage = new Image(source);
+		whole = true;
+	} else if (whole) {
+		memcpy(tmpImage->data, source.data, (size_t)source.width * source.height * source.channels);
+	} else {
+		// The last run only drew over m_restore, so undoing it is enough.
+		tmpImage->dirty.clear();
+		for (const Rect &rect : m_restore) {
+			ImageFilter::CopyRegion(source, *tmpImage, rect);
+		}
+	}
+	std::vector<Rect> restored = std::move(tmpImage->dirty);
+	tmpImage->dirty.clear();
+	filter(*tmpImage, previewScale);
+	m_restore = tmpImage->dirty;
+	if (m_restore.empty()) {
+		whole = true;
+	}
+	for (const Rect &rect : restored) {
+		tmpImage->mark_dirty(rect);
+	}
+	if (tmpImage->texture == 0 || tmpImage->width != textureWidth || tmpImage->height != textureHeight) {
+		tmpImage->load_texture();
+	} else {
+		tmpImage->update_texture(!whole);
+	}
+}
+
+void Base::applyPreview() {
+	int width = image->width, height = image->height;
+	if (proxyImage == nullptr && m_region.x == 0 && m_region.y == 0 && m_region.width == image->width &&
+		m_region.height == image->height) {
+		std::swap(image->data, tmpImage->data);
+		std::swap(image->width, tmpImage->width);
+		std::swap(image->height, tmpImage->height);
+		image->dirty.clear();
+	} else {
+		image->dirty.clear();
+		filter(*image, 1.0f);
+	}
+	imageChanged(width == image->width && height == image->height);
+	done = true;
+}
+
+void Base::imageChanged(bool dirtyOnly) {
+	if (pyramid != nullptr) {
+		if (dirtyOnly && !image->dirty.empty()) {
+			for (const Rect &rect : image->dirty) {
+				pyramid->invalidate(rect);
+			}
+		} else {
+			pyramid->invalidate();
+		}
+	}
+	image->dirty.clear();
+}
+
+// Scales a radius-type parameter to a preview, keeping it at least 1.
+static int scaled(int value, float scale) { return std::max(1, (int)std::lround(value * scale)); }
 
 void Grayscale::setImage(Image &image) {
 	ImageFilter::Grayscale(image);
-	image.update_texture();
+	imageChanged();
 	done = true;
 }
 
@@ -34,7 +512,7 @@ Info Grayscale::getInfo() { return Info(Type_Grayscale); }
 
 void BlackAndWhite::setImage(Image &image) {
 	ImageFilter::BlackAndWhite(image);
-	image.update_texture();
+	imageChanged();
 	done = true;
 }
 
@@ -42,7 +520,7 @@ Info BlackAndWhite::getInfo() { return Info(Type_BlackAndWhite); }
 
 void Invert::setImage(Image &image) {
 	ImageFilter::Invert(image);
-	image.update_texture();
+	imageChanged();
 	done = true;
 }
 
@@ -56,20 +534,22 @@ void Merge::setImage(Image &image) {
 		return;
 	}
 
-	m_mergeImageFilename = selection[0].c_str();
-	Image *image2 = new Image();
-	image2->load(m_mergeImageFilename);
-	ImageFilter::Merge(image, *image2);
-	image.update_texture();
-	delete image2;
+	m_mergeImage = assets->load(selection[0]);
+	if (m_mergeImage == nullptr) {
+		pfd::Notify("Error: Merge", "Could not open " + selection[0], pfd::Icon::error);
+		done = true;
+		return;
+	}
+	ImageFilter::Merge(image, *m_mergeImage);
+	imageChanged();
 	done = true;
 }
 
-Info Merge::getInfo() { return Info(Type_Merge, m_mergeImageFilename); }
+Info Merge::getInfo() { return Info(Type_Merge, m_mergeImage); }
 
 void FlipHorizontally::setImage(Image &image) {
 	ImageFilter::FlipHorizontally(image);
-	image.update_texture();
+	imageChanged();
 	done = true;
 }
 
@@ -77,7 +557,7 @@ Info FlipHorizontally::getInfo() { return Info(Type_FlipHorizontally); }
 
 void FlipVertically::setImage(Image &image) {
 	ImageFilter::FlipVertically(image);
-	image.update_texture();
+	imageChanged();
 	done = true;
 }
 
@@ -85,43 +565,32 @@ Info FlipVertically::getInfo() { return Info(Type_FlipVertically); }
 
 void Rotate::setImage(Image &image) {
 	ImageFilter::Rotate(image);
-	if (image.width == image.height) {
-		image.update_texture();
-	} else {
-		image.load_texture();
-	}
+	imageChanged();
+	done = true;
 }
 
-Info Rotate::getInfo() { return Info(Type_Rotate); }
+Info Rotate::getInfo() { return Info(Type_Rotate, 1); }
 
-void DarkenAndLighten::setImage(Image &image) {
-	tmpImage = new Image(image.width, image.height, image.channels);
-	memcpy(tmpImage->data, image.data, image.width * image.height * image.channels);
-	tmpImage->load_texture();
-	this->image = &image;
-}
+void DarkenAndLighten::setImage(Image &image) { beginPreview(image); }
 
 bool DarkenAndLighten::hasOptionsMenu() { return true; }
 
 void DarkenAndLighten::showOptionsMenu() {
 	if (ImGui::SliderInt("Brightness", &factor, 0, 200)) {
-		memcpy(tmpImage->data, image->data, image->width * image->height * image->channels);
-		ImageFilter::ChangeBrightness(*tmpImage, factor);
-		tmpImage->update_texture();
+		updatePreview();
 	}
 	if (ImGui::Button("Apply brightness")) {
-		std::swap(image->data, tmpImage->data);
-		image->update_texture();
-		done = true;
+		applyPreview();
 	}
 }
 
+void DarkenAndLighten::filter(Image &target, float) { ImageFilter::ChangeBrightness(target, factor); }
+
+int DarkenAndLighten::halo(float) { return 0; }
+
 Info DarkenAndLighten::getInfo() { return Info(Type_DarkenAndLighten, factor); }
 
 void Crop::setImage(Image &image) {
-	tmpImage = new Image(image.width, image.height, image.channels);
-	memcpy(tmpImage->data, image.data, image.width * image.height * image.channels);
-	tmpImage->load_texture();
 	this->image = &image;
 	m_width = image.width;
 	m_height = image.height;
@@ -130,43 +599,132 @@ void Crop::setImage(Image &image) {
 bool Crop::hasOptionsMenu() { return true; }
 
 void Crop::showOptionsMenu() {
-	bool update_frame = false;
-	if (ImGui::SliderInt("Width", &m_width, 0, image->width - m_x)) {
-		update_frame = true;
+	ImGui::SliderInt("Width", &m_width, 0, image->width - m_x);
+	ImGui::SliderInt("Height", &m_height, 0, image->height - m_y);
+	ImGui::SliderInt("X", &m_x, 0, image->width - m_width);
+	ImGui::SliderInt("Y", &m_y, 0, image->height - m_height);
+	if (ImGui::Button("Apply crop")) {
+		ImageFilter::Crop(*image, m_x, m_y, m_width, m_height);
+		imageChanged();
+		done = true;
 	}
-	if (ImGui::SliderInt("Height", &m_height, 0, image->height - m_y)) {
-		update_frame = true;
+}
+
+// Half the side of a handle, and how close the mouse must be to grab an edge, in screen pixels.
+static const float cropHandleRadius = 5.0f;
+
+int Crop::edgesAt(ImVec2 mouse, ImVec2 min, ImVec2 max) const {
+	float r = cropHandleRadius;
+	if (mouse.x < min.x - r || mouse.x > max.x + r || mouse.y < min.y - r || mouse.y > max.y + r) {
+		return Edge_None;
 	}
-	if (ImGui::SliderInt("X", &m_x, 0, image->width - m_width)) {
-		update_frame = true;
+	int edges = Edge_None;
+	if (std::abs(mouse.x - min.x) <= r) {
+		edges |= Edge_Left;
+	} else if (std::abs(mouse.x - max.x) <= r) {
+		edges |= Edge_Right;
 	}
-	if (ImGui::SliderInt("Y", &m_y, 0, image->height - m_height)) {
-		update_frame = true;
+	if (std::abs(mouse.y - min.y) <= r) {
+		edges |= Edge_Top;
+	} else if (std::abs(mouse.y - max.y) <= r) {
+		edges |= Edge_Bottom;
 	}
-	if (update_frame) {
-		unsigned char color[3] = {255, 0, 0};
-		memcpy(tmpImage->data, image->data, image->width * image->height * image->channels);
-		ImageFilter::DrawRectangle(*tmpImage, m_x, m_y, m_width, m_height, 10, color);
-		tmpImage->update_texture();
+	return edges != Edge_None ? edges : Edge_All;
+}
+
+void Crop::drag(ImVec2 mouse) {
+	int dx = (int)std::lround(mouse.x - m_dragStart.x);
+	int dy = (int)std::lround(mouse.y - m_dragStart.y);
+	int x = m_dragRect[0], y = m_dragRect[1], right = x + m_dragRect[2], bottom = y + m_dragRect[3];
+	if (m_dragged == Edge_All) {
+		m_x = std::clamp(x + dx, 0, image->width - m_dragRect[2]);
+		m_y = std::clamp(y + dy, 0, image->height - m_dragRect[3]);
+		return;
 	}
-	if (ImGui::Button("Apply crop")) {
-		ImageFilter::Crop(*image, m_x, m_y, m_width, m_height);
-		image->load_texture();
-		done = true;
+	if (m_dragged & Edge_Left) {
+		x = std::clamp(x + dx, 0, right - 1);
+	} else if (m_dragged & Edge_Right) {
+		right = std::clamp(right + dx, x + 1, image->width);
 	}
+	if (m_dragged & Edge_Top) {
+		y = std::clamp(y + dy, 0, bottom - 1);
+	} else if (m_dragged & Edge_Bottom) {
+		bottom = std::clamp(bottom + dy, y + 1, image->height);
+	}
+	m_x = x;
+	m_y = y;
+	m_width = right - x;
+	m_height = bottom - y;
 }
 
-Info Crop::getInfo() { return Info(Type_Crop, m_x, m_y, m_width, m_height); }
+void Crop::drawOverlay(ImDrawList *drawList, ImVec2 origin, float zoom) {
+	ImVec2 min(origin.x + m_x * zoom, origin.y + m_y * zoom);
+	ImVec2 max(min.x + m_width * zoom, min.y + m_height * zoom);
+	ImVec2 end(origin.x + image->width * zoom, origin.y + image->height * zoom);
+	ImVec2 mouse = ImGui::GetIO().MousePos;
+	ImVec2 mouseInImage((mouse.x - origin.x) / zoom, (mouse.y - origin.y) / zoom);
+
+	if (m_dragged != Edge_None) {
+		if (ImGui::IsMouseDown(ImGuiMouseButton_Left)) {
+			drag(mouseInImage);
+		} else {
+			m_dragged = Edge_None;
+		}
+	}
+	m_hovered = ImGui::IsWindowHovered() ? edgesAt(mouse, min, max) : Edge_None;
+	if (m_dragged == Edge_None && m_hovered != Edge_None && ImGui::IsMouseClicked(ImGuiMouseButton_Left)) {
+		m_dragged = m_hovered;
+		m_dragStart = mouseInImage;
+		m_dragRect[0] = m_x;
+		m_dragRect[1] = m_y;
+		m_dragRect[2] = m_width;
+		m_dragRect[3] = m_height;
+	}
 
-void Frame::setImage(Image &image) {
-	tmpImage = new Image(image.width, image.height, image.channels);
-	memcpy(tmpImage->data, image.data, image.width * image.height * image.channels);
-	ImU32 pcolor = ImGui::ColorConvertFloat4ToU32(color);
-	ImageFilter::Frame(*tmpImage, fanciness, pcolor);
-	tmpImage->load_texture();
-	this->image = &image;
+	int edges = m_dragged != Edge_None ? m_dragged : m_hovered;
+	if (edges == Edge_All) {
+		ImGui::SetMouseCursor(ImGuiMouseCursor_ResizeAll);
+	} else if (edges == (Edge_Left | Edge_Top) || edges == (Edge_Right | Edge_Bottom)) {
+		ImGui::SetMouseCursor(ImGuiMouseCursor_ResizeNWSE);
+	} else if (edges == (Edge_Right | Edge_Top) || edges == (Edge_Left | Edge_Bottom)) {
+		ImGui::SetMouseCursor(ImGuiMouseCursor_ResizeNESW);
+	} else if (edges == Edge_Left || edges == Edge_Right) {
+		ImGui::SetMouseCursor(ImGuiMouseCursor_ResizeEW);
+	} else if (edges == Edge_Top || edges == Edge_Bottom) {
+		ImGui::SetMouseCursor(ImGuiMouseCursor_ResizeNS);
+	}
+
+	// Dim what is cropped away, then outline the kept rectangle and draw its handles.
+	ImU32 shade = IM_COL32(0, 0, 0, 128);
+	drawList->AddRectFilled(origin, ImVec2(end.x, min.y), shade);
+	drawList->AddRectFilled(ImVec2(origin.x, max.y), end, shade);
+	drawList->AddRectFilled(ImVec2(origin.x, min.y), ImVec2(min.x, max.y), shade);
+	drawList->AddRectFilled(ImVec2(max.x, min.y), ImVec2(end.x, max.y), shade);
+	drawList->AddRect(min, max, IM_COL32(255, 0, 0, 255), 0.0f, 0, 2.0f);
+	ImVec2 mid((min.x + max.x) * 0.5f, (min.y + max.y) * 0.5f);
+	const ImVec2 handles[] = {min,
+							  ImVec2(mid.x, min.y),
+							  ImVec2(max.x, min.y),
+							  ImVec2(max.x, mid.y),
+							  max,
+							  ImVec2(mid.x, max.y),
+							  ImVec2(min.x, max.y),
+							  ImVec2(min.x, mid.y)};
+	float r = cropHandleRadius;
+	for (const ImVec2 &handle : handles) {
+		drawList->AddRectFilled(ImVec2(handle.x - r, handle.y - r), ImVec2(handle.x + r, handle.y + r),
+								IM_COL32(255, 255, 255, 255));
+		drawList->AddRect(ImVec2(handle.x - r, handle.y - r), ImVec2(handle.x + r, handle.y + r),
+						  IM_COL32(0, 0, 0, 255));
+	}
 }
 
+bool Crop::wantsMouse() const { return m_hovered != Edge_None || m_dragged != Edge_None; }
+
+Info Crop::getInfo() { return Info(Type_Crop, m_x, m_y, m_width, m_height); }
+
+void Frame::setImage(Image &image) { beginPreview(image); }
+
 bool Frame::hasOptionsMenu() { return true; }
 
 void Frame::showOptionsMenu() {
@@ -186,18 +744,19 @@ void Frame::showOptionsMenu() {
 		update_frame = true;
 	}
 	if (ImGui::Button("Apply frame")) {
-		std::swap(image->data, tmpImage->data);
-		image->update_texture();
-		done = true;
+		applyPreview();
+		return;
 	}
 	if (update_frame) {
-		memcpy(tmpImage->data, image->data, image->width * image->height * image->channels);
-		ImU32 pcolor = ImGui::ColorConvertFloat4ToU32(color);
-		ImageFilter::Frame(*tmpImage, fanciness, pcolor);
-		tmpImage->load_texture();
+		updatePreview();
 	}
 }
 
+void Frame::filter(Image &target, float) {
+	ImU32 pcolor = ImGui::ColorConvertFloat4ToU32(color);
+	ImageFilter::Frame(target, fanciness, pcolor);
+}
+
 Info Frame::getInfo() {
 	ImU32 pcolor = ImGui::ColorConvertFloat4ToU32(color);
 	return Info(Type_Frame, fanciness, pcolor);
@@ -205,16 +764,16 @@ Info Frame::getInfo() {
 
 void DetectEdges::setImage(Image &image) {
 	ImageFilter::DetectEdges(image);
-	image.update_texture();
+	imageChanged();
 	done = true;
 }
 
 Info DetectEdges::getInfo() { return Info(Type_DetectEdges); }
 
 void Resize::setImage(Image &image) {
-	this->image = &image;
 	m_width = image.width;
 	m_height = image.height;
+	beginPreview(image);
 }
 
 bool Resize::hasOptionsMenu() { return true; }
@@ -228,51 +787,41 @@ void Resize::showOptionsMenu() {
 		update_frame = true;
 	}
 	if (update_frame) {
-		delete tmpImage;
-		tmpImage = new Image(image->width, image->height, image->channels);
-		memcpy(tmpImage->data, image->data, image->width * image->height * image->channels);
-		ImageFilter::Resize(*tmpImage, m_width, m_height);
-		tmpImage->load_texture();
+		updatePreview();
 	}
 	if (ImGui::Button("Apply resize")) {
-		image->width = tmpImage->width;
-		image->height = tmpImage->height;
-		std::swap(image->data, tmpImage->data);
-		std::swap(image->texture, tmpImage->texture);
-		done = true;
+		applyPreview();
 	}
 }
 
+void Resize::filter(Image &target, float scale) {
+	ImageFilter::Resize(target, scaled(m_width, scale), scaled(m_height, scale));
+}
+
 Info Resize::getInfo() { return Info(Type_Resize, m_width, m_height); }
 
-void Blur::setImage(Image &image) {
-	tmpImage = new Image(image.width, image.height, image.channels);
-	memcpy(tmpImage->data, image.data, image.width * image.height * image.channels);
-	ImageFilter::Blur(*tmpImage, m_blurLevel);
-	tmpImage->load_texture();
-	this->image = &image;
-}
+void Blur::setImage(Image &image) { beginPreview(image); }
 
 bool Blur::hasOptionsMenu() { return true; }
 
 void Blur::showOptionsMenu() {
 	if (ImGui::SliderInt("Blur Level", &m_blurLevel, 1, 10)) {
-		memcpy(tmpImage->data, image->data, image->width * image->height * image->channels);
-		ImageFilter::Blur(*tmpImage, m_blurLevel);
-		tmpImage->update_texture();
+		updatePreview();
 	}
 	if (ImGui::Button("Apply blur")) {
-		std::swap(image->data, tmpImage->data);
-		image->update_texture();
-		done = true;
+		applyPreview();
 	}
 }
 
+void Blur::filter(Image &target, float scale) { ImageFilter::Blur(target, scaled(m_blurLevel, scale)); }
+
+int Blur::halo(float scale) { return scaled(m_blurLevel, scale); }
+
 Info Blur::getInfo() { return Info(Type_Blur, m_blurLevel); }
 
 void Sunlight::setImage(Image &image) {
 	ImageFilter::Sunlight(image);
-	image.update_texture();
+	imageChanged();
 	done = true;
 }
 
@@ -280,7 +829,7 @@ Info Sunlight::getInfo() { return Info(Type_Sunlight); }
 
 void OilPaint::setImage(Image &image) {
 	ImageFilter::OilPaint(image);
-	image.update_texture();
+	imageChanged();
 	done = true;
 }
 
@@ -288,7 +837,7 @@ Info OilPaint::getInfo() { return Info(Type_OilPaint); }
 
 void Purple::setImage(Image &image) {
 	ImageFilter::Purple(image);
-	image.update_texture();
+	imageChanged();
 	done = true;
 }
 
@@ -296,97 +845,76 @@ Info Purple::getInfo() { return Info(Type_Purple); }
 
 void Infrared::setImage(Image &image) {
 	ImageFilter::Infrared(image);
-	image.update_texture();
+	imageChanged();
 	done = true;
 }
 
 Info Infrared::getInfo() { return Info(Type_Infrared); }
 
-void Skew::setImage(Image &image) {
-	tmpImage = new Image(image.width, image.height, image.channels);
-	memcpy(tmpImage->data, image.data, image.width * image.height * image.channels);
-	ImageFilter::Skew(*tmpImage, m_skewAngle);
-	tmpImage->load_texture();
-	this->image = &image;
-}
+void Skew::setImage(Image &image) { beginPreview(image); }
 
 bool Skew::hasOptionsMenu() { return true; }
 
 void Skew::showOptionsMenu() {
 	if (ImGui::SliderInt("Angle", &m_skewAngle, -89, 89, "%d", ImGuiSliderFlags_AlwaysClamp)) {
-		delete tmpImage;
-		tmpImage = new Image(image->width, image->height, image->channels);
-		memcpy(tmpImage->data, image->data, image->width * image->height * image->channels);
-		if (m_skewAngle != 0) {
-			ImageFilter::Skew(*tmpImage, m_skewAngle);
-		}
-		tmpImage->load_texture();
+		updatePreview();
 	}
 	if (ImGui::Button("Apply skew")) {
-		std::swap(image->data, tmpImage->data);
-		image->width = tmpImage->width;
-		image->load_texture();
-		done = true;
+		applyPreview();
+	}
+}
+
+void Skew::filter(Image &target, float) {
+	if (m_skewAngle != 0) {
+		ImageFilter::Skew(target, m_skewAngle);
 	}
 }
 
 Info Skew::getInfo() { return Info(Type_Skew, m_skewAngle); }
 
-void Glasses3D::setImage(Image &image) {
-	tmpImage = new Image(image.width, image.height, image.channels);
-	memcpy(tmpImage->data, image.data, image.width * image.height * image.channels);
-	intensity = 10;
-	ImageFilter::Glasses3D(*tmpImage, intensity);
-	tmpImage->load_texture();
-	this->image = &image;
-}
+void Glasses3D::setImage(Image &image) { beginPreview(image); }
 
 bool Glasses3D::hasOptionsMenu() { return true; }
 
 void Glasses3D::showOptionsMenu() {
 	if (ImGui::SliderInt("Intensity", &intensity, 0, 50)) {
-		memcpy(tmpImage->data, image->data, image->width * image->height * image->channels);
-		ImageFilter::Glasses3D(*tmpImage, intensity);
-		tmpImage->update_texture();
+		updatePreview();
 	}
 	if (ImGui::Button("Apply effect")) {
-		std::swap(image->data, tmpImage->data);
-		image->update_texture();
-		done = true;
+		applyPreview();
 	}
 }
 
+void Glasses3D::filter(Image &target, float scale) {
+	ImageFilter::Glasses3D(target, (int)std::lround(intensity * scale));
+}
+
+int Glasses3D::halo(float scale) { return (int)std::lround(intensity * scale) + 1; }
+
 Info Glasses3D::getInfo() { return Info(Type_Glasses3D, intensity); }
 
-void MotionBlur::setImage(Image &image) {
-	tmpImage = new Image(image.width, image.height, image.channels);
-	memcpy(tmpImage->data, image.data, image.width * image.height * image.channels);
-	m_blurLevel = 9;
-	ImageFilter::MotionBlur(*tmpImage, m_blurLevel);
-	tmpImage->load_texture();
-	this->image = &image;
-}
+void MotionBlur::setImage(Image &image) { beginPreview(image); }
 
 bool MotionBlur::hasOptionsMenu() { return true; }
 
 void MotionBlur::showOptionsMenu() {
 	if (ImGui::SliderInt("Blur Level", &m_blurLevel, 1, 21)) {
-		memcpy(tmpImage->data, image->data, image->width * image->height * image->channels);
-		ImageFilter::MotionBlur(*tmpImage, m_blurLevel);
-		tmpImage->update_texture();
+		updatePreview();
 	}
 	if (ImGui::Button("Apply blur")) {
-		std::swap(image->data, tmpImage->data);
-		image->update_texture();
-		done = true;
+		applyPreview();
 	}
 }
 
+void MotionBlur::filter(Image &target, float scale) { ImageFilter::MotionBlur(target, scaled(m_blurLevel, scale)); }
+
+int MotionBlur::halo(float scale) { return scaled(m_blurLevel, scale); }
+
 Info MotionBlur::getInfo() { return Info(Type_MotionBlur, m_blurLevel); }
 
 void Emboss::setImage(Image &image) {
 	ImageFilter::Emboss(image);
-	image.update_texture();
+	imageChanged();
 	done = true;
 }
 
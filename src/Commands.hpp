@@ -1,8 +1,12 @@
 #pragma once
 
+#include "AssetCache.hpp"
 #include "Image.hpp"
+#include "Pyramid.hpp"
 
 #include <functional>
+#include <string>
+#include <vector>
 
 #include <imgui.h>
 
@@ -46,29 +50,105 @@ struct Info {
 			int resize_width, resize_height;
 		};
 		int blur_level;
-		const char *merge_image;
+		const Image *merge_image; // owned by the AssetCache
 		int skew_angle;
+		int rotate_turns; // 1 for clockwise, -1 for counter-clockwise
 	};
 	Info() = default;
 	Info(Type ty);
 	Info(Type ty, int);
 	Info(Type ty, int frame_fanciness, unsigned int frame_color);
 	Info(Type ty, int resize_width, int resize_height);
-	Info(Type ty, const char *merge_image);
+	Info(Type ty, const Image *merge_image);
 	Info(Type ty, int crop_x, int crop_y, int crop_width, int crop_height);
+
+	// Commands whose effect can be undone exactly by another command. Undoing them applies the inverse to the
+	// current image instead of restoring a snapshot or replaying the history.
+	bool has_inverse() const;
+	Info inverse() const;
+	// Rough time in milliseconds the command takes on a width x height image, used to decide what is worth caching.
+	double estimated_cost(int width, int height) const;
 };
 
+// Runs the command described by info on image, as applying it, undoing or redoing it from the interface does.
+void apply(Image &image, const Info &info);
+// Parses a command written as name[:argument,...] on the command line, such as "blur:3" or "crop:0,0,640,480". Names
+// are those of the menu, matched ignoring case and anything but letters and digits, so "black-and-white" and
+// "3d_glasses" work. Missing arguments take the defaults of the options menus. Merge takes the path of the image to
+// merge, which is loaded through assets, and Frame a fanciness from 1 to 3 and an RRGGBB color. Throws
+// std::invalid_argument for malformed commands and std::runtime_error if the image to merge cannot be loaded.
+Info parse(const std::string &spec, AssetCache &assets);
+
 class Base {
 public:
 	bool done = false;
 	Image *image = nullptr;
 	Image *tmpImage = nullptr;
+	AssetCache *assets = nullptr;
+	// Pyramid of image, used to build preview proxies cheaply.
+	Pyramid *pyramid = nullptr;
 
 	virtual ~Base();
 	virtual void setImage(Image &image) = 0;
 	virtual bool hasOptionsMenu() { return false; };
 	virtual void showOptionsMenu(){};
 	virtual Info getInfo() = 0;
+	// Draws interactive guides over the image, whose top-left corner is at origin in screen coordinates, and handles
+	// their mouse input. Called every frame after the image is drawn.
+	virtual void drawOverlay(ImDrawList *, ImVec2, float) {}
+	// True while the overlay uses the mouse, so dragging must not pan the image.
+	virtual bool wantsMouse() const { return false; }
+
+	// Fits previews to the display zoom: while zoomed out they are computed on a downscaled proxy of the image that
+	// is no larger than its on-screen footprint. Call before setImage() and whenever the zoom changes.
+	void setZoom(float zoom);
+	// Limits previews of local filters to the visible part of the image, given in image pixels. Only that region
+	// plus a margin is computed, and panning computes just the newly exposed parts.
+	void setViewport(Rect viewport);
+	// On-screen size of tmpImage at the given zoom.
+	ImVec2 previewSize(float zoom) const;
+	// On-screen position of tmpImage relative to the image's top-left corner.
+	ImVec2 previewOffset(float zoom) const;
+	// True when tmpImage only covers part of the image.
+	bool isPreviewPartial() const;
+	// Bytes held by tmpImage and the proxy.
+	size_t previewMemory() const;
+
+protected:
+	// Downscaled copy of image used as the preview source, or nullptr when previews are at full resolution.
+	Image *proxyImage = nullptr;
+	// Size of the preview source relative to image.
+	float previewScale = 1.0f;
+
+	// Runs the command on target, which is previewScale times the size of image. Radius-type parameters must be
+	// multiplied by scale so the preview looks like the full resolution result.
+	virtual void filter(Image &, float) {}
+	// How far around an output pixel the filter reads at the given scale, or -1 if the output depends on the whole
+	// image (or changes its size), in which case previews always cover the whole image.
+	virtual int halo(float) { return -1; }
+	// Sets image and computes the first preview.
+	void beginPreview(Image &image);
+	// Recomputes tmpImage from the preview source.
+	void updatePreview();
+	// Applies the command to image at full resolution, reusing the preview when it already is.
+	void applyPreview();
+	// Invalidates the parts of pyramid that changed along with image: with dirtyOnly, just the rectangles reported
+	// in image->dirty (everything if none were), otherwise everything.
+	void imageChanged(bool dirtyOnly = false);
+
+private:
+	float m_targetScale = 1.0f;
+	Rect m_viewport{};
+	// Part of the preview source that tmpImage holds.
+	Rect m_region{};
+	// What the last filter() run on the whole of tmpImage reported drawing, and so all that needs restoring before
+	// the next run. Empty when the filter does not report its changes.
+	std::vector<Rect> m_restore;
+
+	void makeProxy();
+	Rect visibleRegion() const;
+	void extendRegion(Rect region);
+	void computeRect(Rect rect, Image &target, Rect targetRect);
 };
 
 class Grayscale : public Base {
@@ -95,7 +175,7 @@ public:
 	Info getInfo() override;
 
 private:
-	const char *m_mergeImageFilename;
+	const Image *m_mergeImage = nullptr;
 };
 
 class FlipHorizontally : public Base {
@@ -123,19 +203,44 @@ public:
 	void showOptionsMenu() override;
 	Info getInfo() override;
 
+protected:
+	void filter(Image &, float) override;
+	int halo(float) override;
+
 private:
 	int factor = 100;
 };
 
+// Previews the crop as an overlay with draggable handles; the image is only touched when the crop is applied.
 class Crop : public Base {
 public:
 	void setImage(Image &) override;
 	bool hasOptionsMenu() override;
 	void showOptionsMenu() override;
 	Info getInfo() override;
+	void drawOverlay(ImDrawList *drawList, ImVec2 origin, float zoom) override;
+	bool wantsMouse() const override;
 
 private:
-	int m_x, m_y, m_width, m_height;
+	// Parts of the crop rectangle a drag moves, combined for corners.
+	enum Edge {
+		Edge_None = 0,
+		Edge_Left = 1 << 0,
+		Edge_Right = 1 << 1,
+		Edge_Top = 1 << 2,
+		Edge_Bottom = 1 << 3,
+		Edge_All = Edge_Left | Edge_Right | Edge_Top | Edge_Bottom,
+	};
+
+	int m_x = 0, m_y = 0, m_width, m_height;
+	int m_hovered = Edge_None;
+	int m_dragged = Edge_None;
+	// Mouse position in image pixels and crop rectangle when the drag started.
+	ImVec2 m_dragStart;
+	int m_dragRect[4];
+
+	int edgesAt(ImVec2 mouse, ImVec2 min, ImVec2 max) const;
+	void drag(ImVec2 mouse);
 };
 
 class Frame : public Base {
@@ -145,6 +250,9 @@ public:
 	void showOptionsMenu() override;
 	Info getInfo() override;
 
+protected:
+	void filter(Image &, float) override;
+
 private:
 	int fanciness = 1;
 	ImVec4 color{1.0f, 1.0f, 1.0f, 1.0f};
@@ -163,6 +271,9 @@ public:
 	void showOptionsMenu() override;
 	Info getInfo() override;
 
+protected:
+	void filter(Image &, float) override;
+
 private:
 	int m_width, m_height;
 };
@@ -174,6 +285,10 @@ public:
 	void showOptionsMenu() override;
 	Info getInfo() override;
 
+protected:
+	void filter(Image &, float) override;
+	int halo(float) override;
+
 private:
 	int m_blurLevel = 5;
 };
@@ -213,6 +328,9 @@ public:
 	void showOptionsMenu() override;
 	Info getInfo() override;
 
+protected:
+	void filter(Image &, float) override;
+
 private:
 	int m_skewAngle = 45;
 };
@@ -224,8 +342,12 @@ public:
 	void showOptionsMenu() override;
 	Info getInfo() override;
 
+protected:
+	void filter(Image &, float) override;
+	int halo(float) override;
+
 private:
-	int intensity;
+	int intensity = 10;
 };
 
 class MotionBlur : public Base {
@@ -235,8 +357,12 @@ public:
 	void showOptionsMenu() override;
 	Info getInfo() override;
 
+protected:
+	void filter(Image &, float) override;
+	int halo(float) override;
+
 private:
-	int m_blurLevel;
+	int m_blurLevel = 9;
 };
 
 class Emboss : public Base {
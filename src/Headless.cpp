@@ -0,0 +1,200 @@
+#include "Headless.hpp"
+#include "AssetCache.hpp"
+#include "Batch.hpp"
+#include "Commands.hpp"
+#include "Stats.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <set>
+#include <string>
+#include <system_error>
+#include <vector>
+
+using namespace ayin;
+
+namespace fs = std::filesystem;
+
+namespace {
+const char Usage[] = "usage: ayin --headless -i INPUT -o OUTPUT [-i INPUT -o OUTPUT]... [OPTION]...\n"
+					 "       ayin --headless --batch -i INPUT... -o DIRECTORY [--format EXTENSION] [OPTION]...\n"
+					 "In batch mode an INPUT is a file, a directory or a quoted pattern with * and ? wildcards.\n"
+					 "options: --op NAME[:ARG,...]  --recipe FILE  --memory MEGABYTES  --stats\n";
+
+struct Options {
+	std::vector<std::string> inputs;
+	std::vector<std::string> outputs;
+	// From --op and --recipe, in command line order.
+	std::vector<std::string> operations;
+	bool stats = false;
+	bool batch = false;
+	std::string format;
+	size_t memoryBudget = AYIN_BATCH_MEMORY_BUDGET;
+};
+
+// Appends the operations of a recipe file, one per line. Blank lines and lines starting with # are skipped.
+bool ReadRecipe(const std::string &filename, std::vector<std::string> &operations) {
+	std::ifstream file(fs::u8path(filename));
+	if (!file) {
+		fprintf(stderr, "[ERROR] could not open recipe %s\n", filename.c_str());
+		return false;
+	}
+	std::string line;
+	while (std::getline(file, line)) {
+		auto space = [](char c) { return isspace((unsigned char)c) != 0; };
+		line.erase(line.begin(), std::find_if_not(line.begin(), line.end(), space));
+		line.erase(std::find_if_not(line.rbegin(), line.rend(), space).base(), line.end());
+		if (!line.empty() && line[0] != '#') {
+			operations.push_back(line);
+		}
+	}
+	return true;
+}
+
+bool ParseOptions(int argc, char *argv[], Options &options) {
+	for (int i = 1; i < argc; ++i) {
+		const char *arg = argv[i];
+		if (strcmp(arg, "--headless") == 0) {
+			continue;
+		} else if (strcmp(arg, "--stats") == 0) {
+			options.stats = true;
+			continue;
+		} else if (strcmp(arg, "--batch") == 0) {
+			options.batch = true;
+			continue;
+		}
+		bool known = strcmp(arg, "-i") == 0 || strcmp(arg, "-o") == 0 || strcmp(arg, "--op") == 0 ||
+					 strcmp(arg, "--recipe") == 0 || strcmp(arg, "--format") == 0 || strcmp(arg, "--memory") == 0;
+		if (!known) {
+			fprintf(stderr, "[ERROR] unknown option '%s'\n", arg);
+			return false;
+		}
+		if (i + 1 == argc) {
+			fprintf(stderr, "[ERROR] %s needs an argument\n", arg);
+			return false;
+		}
+		std::string value = argv[++i];
+		if (strcmp(arg, "-i") == 0) {
+			options.inputs.push_back(value);
+		} else if (strcmp(arg, "-o") == 0) {
+			options.outputs.push_back(value);
+		} else if (strcmp(arg, "--op") == 0) {
+			options.operations.push_back(value);
+		} else if (strcmp(arg, "--recipe") == 0) {
+			if (!ReadRecipe(value, options.operations)) {
+				return false;
+			}
+		} else if (strcmp(arg, "--format") == 0) {
+			options.format = value[0] == '.' ? value : "." + value;
+		} else {
+			char *end = nullptr;
+			unsigned long long megabytes = strtoull(value.c_str(), &end, 10);
+			if (value.empty() || *end != '\0' || megabytes == 0) {
+				fprintf(stderr, "[ERROR] '%s' is not a number of megabytes\n", value.c_str());
+				return false;
+			}
+			options.memoryBudget = (size_t)megabytes * 1024 * 1024;
+		}
+	}
+	if (options.batch && (options.inputs.empty() || options.outputs.size() != 1)) {
+		fprintf(stderr, "[ERROR] a batch needs inputs and one output directory\n");
+		return false;
+	}
+	if (!options.batch && (options.inputs.empty() || options.inputs.size() != options.outputs.size())) {
+		fprintf(stderr, "[ERROR] every input needs an output\n");
+		return false;
+	}
+	return true;
+}
+
+// Pairs every file the batch inputs name with a file of the same name in the output directory, with the extension of
+// the requested format or else its own.
+bool BatchItems(const Options &options, std::vector<Batch::Item> &items) {
+	std::vector<std::string> files;
+	for (const std::string &input : options.inputs) {
+		if (!Batch::expand(input, files)) {
+			fprintf(stderr, "[ERROR] no files match %s\n", input.c_str());
+			return false;
+		}
+	}
+	fs::path directory = fs::u8path(options.outputs[0]);
+	std::error_code ec;
+	fs::create_directories(directory, ec);
+	if (!fs::is_directory(directory, ec)) {
+		fprintf(stderr, "[ERROR] could not create the directory %s\n", options.outputs[0].c_str());
+		return false;
+	}
+	std::set<std::string> outputs;
+	for (const std::string &file : files) {
+		fs::path path = fs::u8path(file);
+		std::string extension = options.format.empty() ? path.extension().u8string() : options.format;
+		std::transform(extension.begin(), extension.end(), extension.begin(), [](char c) { return (char)tolower(c); });
+		std::string output = (directory / path.stem()).u8string() + extension;
+		if (!outputs.insert(output).second) {
+			fprintf(stderr, "[ERROR] more than one input would be saved to %s\n", output.c_str());
+			return false;
+		}
+		items.push_back(Batch::Item{file, output});
+	}
+	return true;
+}
+} // namespace
+
+bool Headless::requested(int argc, char *argv[]) {
+	for (int i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "--headless") == 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+int Headless::run(int argc, char *argv[]) {
+	double start = Stats::now();
+	Options options;
+	if (!ParseOptions(argc, argv, options)) {
+		fputs(Usage, stderr);
+		return EXIT_FAILURE;
+	}
+
+	// Images to merge are loaded once here and shared by every input.
+	AssetCache assets;
+	std::vector<Commands::Info> commands;
+	for (const std::string &operation : options.operations) {
+		try {
+			commands.push_back(Commands::parse(operation, assets));
+		} catch (const std::exception &exc) {
+			fprintf(stderr, "[ERROR] %s\n", exc.what());
+			return EXIT_FAILURE;
+		}
+	}
+
+	std::vector<Batch::Item> items;
+	if (options.batch) {
+		if (!BatchItems(options, items)) {
+			return EXIT_FAILURE;
+		}
+	} else {
+		for (size_t i = 0; i < options.inputs.size(); ++i) {
+			items.push_back(Batch::Item{options.inputs[i], options.outputs[i]});
+		}
+	}
+	if (options.stats) {
+		printf("startup %.1f ms\n", Stats::now() - start);
+	}
+
+	Batch::Summary summary = Batch::run(items, commands, options.memoryBudget, options.stats);
+	if (options.stats || options.batch) {
+		double seconds = std::max(summary.ms, 1.0) / 1000.0;
+		printf("%zu images in %.2f s, %zu failed: %.1f images/s, %.1f MB/s read, %.1f MB/s written, %.1f MP/s\n",
+			   summary.images, seconds, summary.failed, summary.images / seconds, summary.bytes_read / 1e6 / seconds,
+			   summary.bytes_written / 1e6 / seconds, summary.megapixels / seconds);
+	}
+	return summary.failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+// Command-line processing without a window: `ayin --headless -i in.jpg -o out.png --op blur:3 --op grayscale` loads
+// each input, runs the operations on it in order through the same code as the editor, and saves it to the matching
+// output. With --batch, the inputs may also be directories or wildcard patterns and every file goes to one output
+// directory; see Batch for how the files are spread over the cores. Nothing initializes SDL or creates a GL context,
+// so it runs on machines without a display.
+namespace ayin::Headless {
+// True if the command line asks for headless processing.
+bool requested(int argc, char *argv[]);
+// Processes the images given on the command line and returns the exit status of the program. With --stats, prints how
+// long starting up took and, for each image, the time spent loading, in each operation and saving. Batches, and runs
+// with --stats, end with the throughput in images and megabytes per second.
+int run(int argc, char *argv[]);
+} // namespace ayin::Headless
@@ -1,6 +1,17 @@
 #include "Image.hpp"
-
+#include "MappedFile.hpp"
+#include "Png.hpp"
+#include "Pnm.hpp"
+#include "Qoi.hpp"
+#include "Stats.hpp"
+#include "TextureUpload.hpp"
+
+#include <algorithm>
+#include <climits>
+#include <cstdio>
 #include <cstring>
+#include <filesystem>
+#include <system_error>
 
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
@@ -10,36 +21,129 @@
 
 using namespace ayin;
 
+Rect Rect::intersect(const Rect &r) const {
+	int x0 = std::max(x, r.x), y0 = std::max(y, r.y);
+	int x1 = std::min(x + width, r.x + r.width), y1 = std::min(y + height, r.y + r.height);
+	return x1 > x0 && y1 > y0 ? Rect{x0, y0, x1 - x0, y1 - y0} : Rect{};
+}
+
+Rect Rect::unite(const Rect &r) const {
+	if (empty()) {
+		return r;
+	}
+	if (r.empty()) {
+		return *this;
+	}
+	int x0 = std::min(x, r.x), y0 = std::min(y, r.y);
+	int x1 = std::max(x + width, r.x + r.width), y1 = std::max(y + height, r.y + r.height);
+	return Rect{x0, y0, x1 - x0, y1 - y0};
+}
+
 Image::Image(int width, int height, int channels) : width(width), height(height), channels(channels) {
-	data = (unsigned char *)malloc(width * height * channels);
+	data = allocate_data((size_t)width * height * channels);
 }
 
 Image::Image(const Image &image) : Image(image.width, image.height, image.channels) {
-	memcpy(data, image.data, width * height * channels);
+	memcpy(data, image.data, (size_t)width * height * channels);
 }
 
 Image::~Image() {
-#ifndef NDEBUG
-	static int i = 0;
-	printf("[DEBUG] %d Image::~Image()\n", ++i);
-#endif
-	stbi_image_free(data);
-	glDeleteTextures(1, &texture);
+	free_data(data);
+	// Headless runs have no GL context, and their images never get a texture.
+	if (texture) {
+		glDeleteTextures(1, &texture);
+	}
 }
 
-bool Image::load(const char *filename) {
-	if (data != nullptr) {
+unsigned char *Image::allocate_data(size_t size) {
+	if (size >= AYIN_IMAGE_DISK_BACKED_MIN_SIZE) {
+		if (unsigned char *data = MappedFile::allocate(size)) {
+			return data;
+		}
+	}
+	return (unsigned char *)calloc(size, 1);
+}
+
+void Image::free_data(unsigned char *data) {
+	if (!MappedFile::deallocate(data)) {
 		stbi_image_free(data);
 	}
+}
+
+bool Image::allocate(int width, int height, int channels) {
+	free_data(data);
+	if (texture) {
+		glDeleteTextures(1, &texture);
+	}
+	texture = 0;
+	this->width = width;
+	this->height = height;
+	this->channels = channels;
+	data = allocate_data((size_t)width * height * channels);
+	return data != nullptr;
+}
+
+bool Image::load(const char *filename, std::atomic<float> *progress) {
+	// Probing the header of a pipe would consume it, so only regular files are streamed.
+	std::error_code ec;
+	bool regular = std::filesystem::is_regular_file(std::filesystem::u8path(filename), ec);
+	int w, h, c;
+	bool pnm = regular && Pnm::info(filename, w, h, c);
+	if (pnm || (regular && stbi_info(filename, &w, &h, &c) && (size_t)w * h * c >= AYIN_IMAGE_STREAM_MIN_SIZE)) {
+		if (FILE *file = fopen(filename, "rb")) {
+			double start = Stats::now();
+			bool ok = pnm ? Pnm::decode(file, *this, progress) : Png::decode(file, *this, progress);
+			long size = ftell(file);
+			fclose(file);
+			if (ok) {
+				// Reading is interleaved with decoding, so all of the time counts as decoding.
+				Stats::add_input_read(size > 0 ? (size_t)size : 0, 0.0);
+				Stats::add_input_decode(Stats::now() - start, (double)width * height / 1e6);
+			}
+			// Other PNGs, such as interlaced ones, are left to stb_image.
+			if (ok || pnm) {
+				return ok;
+			}
+		}
+	}
+	FileContents file;
+	return file.read(filename) && load_from_memory(file.data(), file.size());
+}
+
+bool Image::info(const char *filename, int &width, int &height, int &channels) {
+	return stbi_info(filename, &width, &height, &channels) != 0 || Pnm::info(filename, width, height, channels) ||
+		   Qoi::info(filename, width, height, channels);
+}
+
+bool Image::load_from_memory(const unsigned char *buffer, size_t size) {
+	if (data != nullptr) {
+		free_data(data);
+	}
 	if (texture) {
 		glDeleteTextures(1, &texture);
 	}
-	data = stbi_load(filename, &width, &height, &channels, 0);
+	data = nullptr;
+	texture = 0;
+	if (size > (size_t)INT_MAX) {
+		return false;
+	}
+	double start = Stats::now();
+	if (Qoi::is_qoi(buffer, size)) {
+		// Decodes into a buffer of our own, which large images get from disk like the streamed formats.
+		if (!Qoi::decode(buffer, size, *this)) {
+			return false;
+		}
+	} else {
+		data = stbi_load_from_memory(buffer, (int)size, &width, &height, &channels, 0);
+	}
+	if (data != nullptr) {
+		Stats::add_input_decode(Stats::now() - start, (double)width * height / 1e6);
+	}
 	return data != nullptr;
 }
 
 void Image::clear() {
-	std::memset(data, 0, width * height * channels);
+	std::memset(data, 0, (size_t)width * height * channels);
 }
 
 bool Image::save(const char *filename) {
@@ -50,20 +154,55 @@ bool Image::save(const char *filename) {
 	}
 
 	if (strcmp(extension, ".png") == 0) {
-		return stbi_write_png(filename, width, height, STBI_rgb, data, 0);
+		return Png::write(filename, data, width, height, channels);
 	} else if (strcmp(extension, ".bmp") == 0) {
-		return stbi_write_bmp(filename, width, height, STBI_rgb, data);
+		return stbi_write_bmp(filename, width, height, channels, data);
 	} else if (strcmp(extension, ".tga") == 0) {
-		return stbi_write_tga(filename, width, height, STBI_rgb, data);
+		return stbi_write_tga(filename, width, height, channels, data);
 	} else if (strcmp(extension, ".jpg") == 0 || strcmp(extension, ".jpeg") == 0) {
-		return stbi_write_jpg(filename, width, height, STBI_rgb, data, 90);
+		return stbi_write_jpg(filename, width, height, channels, data, 90);
+	} else if (strcmp(extension, ".qoi") == 0) {
+		return Qoi::write(filename, data, width, height, channels);
+	} else if (strcmp(extension, ".ppm") == 0 || strcmp(extension, ".pgm") == 0 || strcmp(extension, ".pnm") == 0) {
+		return Pnm::write(filename, data, width, height, channels);
+	} else if (strcmp(extension, ".pam") == 0) {
+		return Pnm::write(filename, data, width, height, channels, true);
 	}
 
 	return false;
 }
 
+static long long Area(const Rect &r) { return (long long)r.width * r.height; }
+
+void Image::mark_dirty(Rect rect) {
+	rect = rect.intersect(Rect{0, 0, width, height});
+	if (rect.empty()) {
+		return;
+	}
+	for (const Rect &d : dirty) {
+		if (d.contains(rect)) {
+			return;
+		}
+	}
+	if (dirty.size() < AYIN_IMAGE_MAX_DIRTY_RECTS) {
+		dirty.push_back(rect);
+		return;
+	}
+	size_t best = 0;
+	long long bestGrowth = -1;
+	for (size_t i = 0; i < dirty.size(); ++i) {
+		long long growth = Area(dirty[i].unite(rect)) - Area(dirty[i]);
+		if (bestGrowth < 0 || growth < bestGrowth) {
+			best = i;
+			bestGrowth = growth;
+		}
+	}
+	dirty[best] = dirty[best].unite(rect);
+}
+
 void Image::load_texture() {
 	glDeleteTextures(1, &texture);
+	dirty.clear();
 
 	GLint format = channels == 3 ? GL_RGB : GL_RGBA;
 	glGenTextures(1, &texture);
@@ -74,17 +213,35 @@ void Image::load_texture() {
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 
-	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-	glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
+	glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, nullptr);
+	TextureUpload::upload(*this, Rect{0, 0, width, height});
+	TextureUpload::finish();
 }
 
-void Image::update_texture() const {
-	GLint format = channels == 3 ? GL_RGB : GL_RGBA;
+void Image::unload_texture() {
+	if (texture) {
+		glDeleteTextures(1, &texture);
+		texture = 0;
+	}
+	dirty.clear();
+}
+
+void Image::update_texture(bool dirty_only) {
 	glBindTexture(GL_TEXTURE_2D, texture);
-	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, format, GL_UNSIGNED_BYTE, data);
+	if (!dirty_only || dirty.empty()) {
+		TextureUpload::upload(*this, Rect{0, 0, width, height});
+	} else {
+		for (const Rect &rect : dirty) {
+			TextureUpload::upload(*this, rect);
+		}
+	}
+	TextureUpload::finish();
+	dirty.clear();
 }
 
-unsigned char &Image::operator()(int x, int y, int c) { return data[(y * width + x) * channels + c]; }
+// Offsets are computed in size_t: the pixels of a large image exceed INT_MAX bytes.
+unsigned char &Image::operator()(int x, int y, int c) { return data[((size_t)y * width + x) * channels + c]; }
 
-const unsigned char &Image::operator()(int x, int y, int c) const { return data[(y * width + x) * channels + c]; }
+const unsigned char &Image::operator()(int x, int y, int c) const {
+	return data[((size_t)y * width + x) * channels + c];
+}
@@ -1,12 +1,51 @@
 #pragma once
 
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+#ifndef AYIN_IMAGE_MAX_DIRTY_RECTS
+#define AYIN_IMAGE_MAX_DIRTY_RECTS 32
+#endif
+
+#ifndef AYIN_IMAGE_STREAM_MIN_SIZE
+// Decoded size from which PNGs are decoded row by row from the file, rather than from the whole file in memory.
+#define AYIN_IMAGE_STREAM_MIN_SIZE ((size_t)64 * 1024 * 1024)
+#endif
+
+#ifndef AYIN_IMAGE_DISK_BACKED_MIN_SIZE
+// Pixel buffers from this size on live in memory-mapped temporary files (MappedFile::allocate()) instead of the heap.
+#define AYIN_IMAGE_DISK_BACKED_MIN_SIZE ((size_t)1024 * 1024 * 1024)
+#endif
+
 namespace ayin {
+struct Rect {
+	int x = 0;
+	int y = 0;
+	int width = 0;
+	int height = 0;
+
+	bool empty() const { return width <= 0 || height <= 0; }
+	// In 64 bits, so rectangles from untrusted input reaching past INT_MAX are not contained instead of wrapping.
+	bool contains(const Rect &r) const {
+		return r.x >= x && r.y >= y && (long long)r.x + r.width <= (long long)x + width &&
+			   (long long)r.y + r.height <= (long long)y + height;
+	}
+	Rect intersect(const Rect &r) const;
+	// Smallest rectangle containing both.
+	Rect unite(const Rect &r) const;
+	Rect expand(int dx, int dy) const { return Rect{x - dx, y - dy, width + 2 * dx, height + 2 * dy}; }
+};
+
 struct Image {
 	int width = 0;
 	int height = 0;
 	int channels = 0;
 	unsigned char *data = nullptr;
 	unsigned int texture = 0;
+	// Parts of data changed since the texture was last uploaded, as reported through mark_dirty(). Only code that
+	// reports every change it makes may rely on it; anything else uploads the whole image.
+	std::vector<Rect> dirty;
 
 	Image() = default;
 	Image(const Image &);
@@ -14,11 +53,32 @@ struct Image {
 	~Image();
 
 	void clear();
-	bool load(const char *filename);
+	// Decodes straight from a memory mapping of the file, or from a copy for files that cannot be mapped. PNM files,
+	// and PNGs of at least AYIN_IMAGE_STREAM_MIN_SIZE, are decoded row by row as the file is read instead, so memory
+	// stays bounded by the image itself; progress, if given, goes from 0 to 1 meanwhile.
+	bool load(const char *filename, std::atomic<float> *progress = nullptr);
+	// Reads only the file's header. Returns false if it is not an image we can decode.
+	static bool info(const char *filename, int &width, int &height, int &channels);
+	bool load_from_memory(const unsigned char *buffer, size_t size);
 	bool save(const char *filename);
+	// Replaces the pixels with a zeroed buffer of the given dimensions. Returns false if it cannot be allocated.
+	bool allocate(int width, int height, int channels);
+
+	// Pixel buffers of any image, zeroed, from the heap or, from AYIN_IMAGE_DISK_BACKED_MIN_SIZE on, from
+	// MappedFile::allocate(). Buffers from stb_image are freed with free_data() as well.
+	static unsigned char *allocate_data(size_t size);
+	static void free_data(unsigned char *data);
+
+	// Records that rect of data changed. Beyond AYIN_IMAGE_MAX_DIRTY_RECTS rectangles, new ones are merged into the
+	// rectangle they grow the least.
+	void mark_dirty(Rect rect);
 
 	void load_texture();
-	void update_texture() const;
+	// Deletes the texture, keeping the pixels.
+	void unload_texture();
+	// Uploads data to the texture. With dirty_only, only the dirty rectangles are uploaded (everything when there are
+	// none); the caller must know nothing else changed.
+	void update_texture(bool dirty_only = false);
 
 	unsigned char &operator()(int x, int y, int c);
 	const unsigned char &operator()(int x, int y, int c) const;
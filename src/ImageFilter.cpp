@@ -1,9 +1,15 @@
 #include <algorithm>
+#include <cstdint>
 #include <cstring>
+#include <vector>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #define _USE_MATH_DEFINES
 #include <cmath>
 
 #include "ImageFilter.hpp"
+#include "ThreadPool.hpp"
 
 using namespace ayin;
 
@@ -53,7 +59,20 @@ void ImageFilter::Rotate(Image &image) {
 	for (int i = 0; i < image.width; ++i) {
 		for (int j = 0; j < image.height; ++j) {
 			for (int k = 0; k < image.channels; ++k) {
-				flipped_image(image.height - j, i, k) = image(i, j, k);
+				flipped_image(image.height - 1 - j, i, k) = image(i, j, k);
+			}
+		}
+	}
+	std::swap(image.data, flipped_image.data);
+	std::swap(image.width, image.height);
+}
+
+void ImageFilter::RotateCounterClockwise(Image &image) {
+	Image flipped_image(image.height, image.width, image.channels);
+	for (int i = 0; i < image.width; ++i) {
+		for (int j = 0; j < image.height; ++j) {
+			for (int k = 0; k < image.channels; ++k) {
+				flipped_image(j, image.width - 1 - i, k) = image(i, j, k);
 			}
 		}
 	}
@@ -79,6 +98,10 @@ void ImageFilter::DrawRectangle(Image &image, int x, int y, int width, int heigh
 			}
 		}
 	}
+	image.mark_dirty(Rect{x, y, width, thickness});
+	image.mark_dirty(Rect{x, y + height - thickness, width, thickness});
+	image.mark_dirty(Rect{x, y + thickness, thickness, height - 2 * thickness});
+	image.mark_dirty(Rect{x + width - thickness, y + thickness, thickness, height - 2 * thickness});
 }
 
 static void DrawFilledRectangle(Image &image, int x, int y, int width, int height, unsigned char *color) {
@@ -89,6 +112,15 @@ static void DrawFilledRectangle(Image &image, int x, int y, int width, int heigh
 			}
 		}
 	}
+	image.mark_dirty(Rect{x, y, width, height});
+}
+
+void ImageFilter::CopyRegion(const Image &src, Image &dst, Rect rect) {
+	rect = rect.intersect(Rect{0, 0, dst.width, dst.height});
+	for (int j = 0; j < rect.height; ++j) {
+		memcpy(&dst(rect.x, rect.y + j, 0), &src(rect.x, rect.y + j, 0), (size_t)rect.width * dst.channels);
+	}
+	dst.mark_dirty(rect);
 }
 
 void ImageFilter::Frame(Image &image, int fanciness, unsigned int pcolor) {
@@ -169,52 +201,21 @@ void ImageFilter::Frame(Image &image, int fanciness, unsigned int pcolor) {
 }
 
 void ImageFilter::FlipHorizontally(Image &image) {
-	int width = image.width;
-	int middle = width / 2;
-	bool isEven = width % 2 == 0;
-	int end = isEven ? middle - 2 : middle - 1;
-	for (int i = 0; i < end; i++) {
-		for (int j = 0; j < image.height; j++) {
-			for (int c = 0; c < 3; c++) {
-				int temp = image(i, j, c);
-				image(i, j, c) = image(width - i - 1, j, c);
-				image(width - i - 1, j, c) = temp;
-			}
-		}
-	}
-	if (isEven) {
-		for (int j = 0; j < image.height; j++) {
-			for (int c = 0; c < 3; c++) {
-				int temp = image(middle, j, c);
-				image(middle, j, c) = image(middle - 1, j, c);
-				image(middle - 1, j, c) = temp;
+	for (int j = 0; j < image.height; j++) {
+		for (int i = 0; i < image.width / 2; i++) {
+			for (int c = 0; c < image.channels; c++) {
+				std::swap(image(i, j, c), image(image.width - i - 1, j, c));
 			}
 		}
 	}
 }
 
 void ImageFilter::FlipVertically(Image &image) {
-	int height = image.height;
-	int middle = height / 2;
-	bool isEven = height % 2 == 0;
-	int end = isEven ? middle - 2 : middle - 1;
-	for (int j = 0; j < end; j++) {
-		for (int i = 0; i < image.width; ++i) {
-			for (int c = 0; c < 3; c++) {
-				int temp = image(i, j, c);
-				image(i, j, c) = image(i, height - j - 1, c);
-				image(i, height - j - 1, c) = temp;
-			}
-		}
-	}
-	if (isEven) {
-		for (int i = 0; i < image.width; ++i) {
-			for (int c = 0; c < 3; c++) {
-				int temp = image(i, middle, c);
-				image(i, middle, c) = image(i, middle - 1, c);
-				image(i, middle - 1, c) = temp;
-			}
-		}
+	int rowSize = image.width * image.channels;
+	for (int j = 0; j < image.height / 2; j++) {
+		unsigned char *top = &image(0, j, 0);
+		unsigned char *bottom = &image(0, image.height - j - 1, 0);
+		std::swap_ranges(top, top + rowSize, bottom);
 	}
 }
 
@@ -253,7 +254,84 @@ void ImageFilter::Resize(Image &image, int w, int h) {
 	image.height = h;
 }
 
-void ImageFilter::Merge(Image &image1, Image &image2) {
+void ImageFilter::Downscale(const Image &src, Image &dst) {
+	ThreadPool::global().parallel_for(dst.height, [&](int y) {
+		int y0 = (int)((long long)y * src.height / dst.height);
+		int y1 = std::max(y0 + 1, (int)((long long)(y + 1) * src.height / dst.height));
+		for (int x = 0; x < dst.width; ++x) {
+			int x0 = (int)((long long)x * src.width / dst.width);
+			int x1 = std::max(x0 + 1, (int)((long long)(x + 1) * src.width / dst.width));
+			int count = (x1 - x0) * (y1 - y0);
+			for (int c = 0; c < dst.channels; ++c) {
+				unsigned int sum = 0;
+				for (int j = y0; j < y1; ++j) {
+					for (int i = x0; i < x1; ++i) {
+						sum += src(i, j, c);
+					}
+				}
+				dst(x, y, c) = (sum + count / 2) / (unsigned int)count;
+			}
+		}
+	});
+}
+
+// Sums two rows byte by byte into 16-bit lanes.
+static void AddRows(const unsigned char *a, const unsigned char *b, uint16_t *sum, int n) {
+	int i = 0;
+#ifdef __SSE2__
+	const __m128i zero = _mm_setzero_si128();
+	for (; i + 16 <= n; i += 16) {
+		__m128i va = _mm_loadu_si128((const __m128i *)(a + i));
+		__m128i vb = _mm_loadu_si128((const __m128i *)(b + i));
+		__m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(va, zero), _mm_unpacklo_epi8(vb, zero));
+		__m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(va, zero), _mm_unpackhi_epi8(vb, zero));
+		_mm_storeu_si128((__m128i *)(sum + i), lo);
+		_mm_storeu_si128((__m128i *)(sum + i + 8), hi);
+	}
+#endif
+	for (; i < n; ++i) {
+		sum[i] = a[i] + b[i];
+	}
+}
+
+template <int Channels>
+static void ReducePairs(const uint16_t *sum, unsigned char *dst, int x0, int x1, int channels) {
+	const int ch = Channels ? Channels : channels;
+	for (int x = x0; x < x1; ++x) {
+		const uint16_t *s = sum + 2 * x * ch;
+		for (int c = 0; c < ch; ++c) {
+			dst[x * ch + c] = (s[c] + s[ch + c] + 2) >> 2;
+		}
+	}
+}
+
+void ImageFilter::Reduce(const Image &src, Image &dst, Rect rect) {
+	rect = rect.intersect(Rect{0, 0, dst.width, dst.height});
+	if (rect.empty()) {
+		return;
+	}
+	const int rowsPerJob = 32;
+	int jobs = (rect.height + rowsPerJob - 1) / rowsPerJob;
+	ThreadPool::global().parallel_for(jobs, [&](int job) {
+		int ch = src.channels;
+		int n = 2 * rect.width * ch;
+		std::vector<uint16_t> sum(n);
+		int y1 = std::min(rect.y + (job + 1) * rowsPerJob, rect.y + rect.height);
+		for (int y = rect.y + job * rowsPerJob; y < y1; ++y) {
+			AddRows(&src(2 * rect.x, 2 * y, 0), &src(2 * rect.x, 2 * y + 1, 0), sum.data(), n);
+			unsigned char *row = &dst(rect.x, y, 0);
+			if (ch == 3) {
+				ReducePairs<3>(sum.data(), row, 0, rect.width, ch);
+			} else if (ch == 4) {
+				ReducePairs<4>(sum.data(), row, 0, rect.width, ch);
+			} else {
+				ReducePairs<0>(sum.data(), row, 0, rect.width, ch);
+			}
+		}
+	});
+}
+
+void ImageFilter::Merge(Image &image1, const Image &image2) {
 	int minWidth = std::min(image1.width, image2.width);
 	int minHeight = std::min(image1.height, image2.height);
 	for (int i = 0; i < minWidth; i++) {
@@ -14,14 +14,22 @@ namespace ayin::ImageFilter {
 void Grayscale(Image &image);
 void BlackAndWhite(Image &image);
 void Invert(Image &image);
-void Merge(Image &image1, Image &image2);
+void Merge(Image &image1, const Image &image2);
 void FlipHorizontally(Image &image);
 void FlipVertically(Image &image);
 void Rotate(Image &image);
+void RotateCounterClockwise(Image &image);
+// Drawing primitives (and Frame, which is built from them) report what they change through Image::mark_dirty().
 void DrawRectangle(Image &image, int x, int y, int width, int height, int thickness, unsigned char *color);
 void Frame(Image &image, int fanciness, unsigned int color);
+// Copies rect of src into the same place in dst, which has the same size, and marks it dirty.
+void CopyRegion(const Image &src, Image &dst, Rect rect);
 void Crop(Image &image, int x, int y, int w, int h);
 void Resize(Image &image, int w, int h);
+// Box-filters src into dst, which must be allocated at the target size and no larger than src.
+void Downscale(const Image &src, Image &dst);
+// Writes the 2x2 box averages of src into rect (in dst pixels) of dst, which is half the size of src.
+void Reduce(const Image &src, Image &dst, Rect rect);
 void ChangeBrightness(Image &image, int factor);
 void DetectEdges(Image &image);
 void Blur(Image &image, int level);
@@ -1,11 +1,16 @@
 #include "Application.hpp"
 #include "Commands.hpp"
+#include "Headless.hpp"
 #include "Image.hpp"
+#include "Stats.hpp"
 #include "fonts/MaterialIcons.hpp"
 
+#include <algorithm>
+#include <cmath>
 #include <cstdio>
 #include <cstdlib>
 #include <exception>
+#include <string>
 #include <vector>
 
 using namespace ayin;
@@ -15,16 +20,41 @@ const ImGuiWindowFlags window_flags =
 
 const ImGuiTabBarFlags tabbar_flags = ImGuiTabBarFlags_AutoSelectNewTabs | ImGuiTabBarFlags_FittingPolicyScroll;
 
+// Draws a rotating arc in the middle of a rectangle, with its outline, for a photo that is still loading. A progress
+// above 0 is shown as a percentage under the arc.
+static void DrawSpinner(ImVec2 min, ImVec2 max, float progress) {
+	ImDrawList *drawList = ImGui::GetWindowDrawList();
+	ImU32 color = ImGui::GetColorU32(ImGuiCol_Text);
+	drawList->AddRect(min, max, ImGui::GetColorU32(ImGuiCol_Border));
+	ImVec2 center((min.x + max.x) * 0.5f, (min.y + max.y) * 0.5f);
+	float radius = std::clamp(std::min(max.x - min.x, max.y - min.y) * 0.1f, 6.0f, 24.0f);
+	float start = (float)ImGui::GetTime() * 6.0f;
+	drawList->PathArcTo(center, radius, start, start + 4.5f, 24);
+	drawList->PathStroke(color, 0, radius * 0.25f);
+	if (progress > 0.0f) {
+		char text[8];
+		snprintf(text, sizeof(text), "%d%%", (int)(progress * 100.0f));
+		ImVec2 size = ImGui::CalcTextSize(text);
+		drawList->AddText(ImVec2(center.x - size.x * 0.5f, center.y + radius * 1.5f), color, text);
+	}
+}
+
 int main(int argc, char *argv[]) try {
+	if (Headless::requested(argc, argv)) {
+		return Headless::run(argc, argv);
+	}
+
 	Commands::Base *cmd = nullptr;
 	Application app("Ayin");
 
 	for (int i = 1; i < argc; i++) {
-		app.add_photo(argv[i]);
+		app.add_photo(argv[i], false);
 	}
 
 	while (!app.done) {
 		InputRequest input_req = app.handle_input();
+		app.update_loads();
+		app.update_saves();
 		app.new_frame();
 
 		if (ImGui::BeginMainMenuBar()) {
@@ -43,16 +73,24 @@ int main(int argc, char *argv[]) try {
 				ImGui::EndMenu();
 			}
 			if (ImGui::BeginMenu("Edit")) {
-				if (ImGui::MenuItem("Undo", "Ctrl+Z")) {
+				// A command whose options are open was started on the current image; see below.
+				if (ImGui::MenuItem("Undo", "Ctrl+Z", false, cmd == nullptr)) {
 					input_req.ty = InputRequest_Undo;
 				}
-				if (ImGui::MenuItem("Redo", "Ctrl+Y")) {
+				if (ImGui::MenuItem("Redo", "Ctrl+Y", false, cmd == nullptr)) {
 					input_req.ty = InputRequest_Redo;
 				}
 				ImGui::EndMenu();
 			}
+			if (ImGui::BeginMenu("View")) {
+				ImGui::MenuItem("Statistics", NULL, &app.show_stats);
+				ImGui::MenuItem("Performance Overlay", "F3", &app.show_hud);
+				ImGui::EndMenu();
+			}
 			ImGui::EndMainMenuBar();
 		}
+		app.show_stats_window();
+		app.show_hud_window(cmd);
 
 		if (app.photos.empty()) {
 			app.render();
@@ -69,7 +107,9 @@ int main(int argc, char *argv[]) try {
 					int flags = (photo->can_undo_change() && (photo->name) == (*it)->name)
 									? ImGuiTabItemFlags_UnsavedDocument
 									: ImGuiTabItemFlags_None;
-					if (ImGui::BeginTabItem((*it)->name.c_str(), NULL, flags)) {
+					// The ID stays the name while the label changes, so the tab keeps its state.
+					std::string label = (*it)->name + ((*it)->pending_save ? " (saving)" : "") + "###" + (*it)->name;
+					if (ImGui::BeginTabItem(label.c_str(), NULL, flags)) {
 						if ((photo->name) != (*it)->name) {
 							app.set_selected_photo(i);
 							photo = app.get_selected_photo();
@@ -78,8 +118,8 @@ int main(int argc, char *argv[]) try {
 							ImVec2 cursor_pos = ImGui::GetCursorPos();
 							ImVec2 content_region = ImGui::GetContentRegionAvail();
 							ImVec2 content_pos = ImGui::GetWindowPos();
-							if (ImGui::IsMouseDown(ImGuiMouseButton_Left) && app.io->MousePos.x >= content_pos.x &&
-								app.io->MousePos.y >= content_pos.y) {
+							if (ImGui::IsMouseDown(ImGuiMouseButton_Left) && !(cmd && cmd->wantsMouse()) &&
+								app.io->MousePos.x >= content_pos.x && app.io->MousePos.y >= content_pos.y) {
 								photo->x += app.io->MouseDelta.x;
 								photo->y += app.io->MouseDelta.y;
 							}
@@ -89,18 +129,43 @@ int main(int argc, char *argv[]) try {
 									   input_req.ty == InputRequest_ZoomOut) {
 								photo->zoom = std::max(photo->zoom / 1.03f, 0.1f);
 							}
-							ImGui::SetCursorPos(ImVec2(
+							ImVec2 origin(
 								photo->x + cursor_pos.x + (content_region.x - photo->image->width * photo->zoom) * 0.5f,
-								photo->y + cursor_pos.y +
-									(content_region.y - photo->image->height * photo->zoom) * 0.5f));
-							if (cmd && cmd->tmpImage) {
-								ImGui::Image(
-									(void *)(intptr_t)cmd->tmpImage->texture,
-									ImVec2(cmd->tmpImage->width * photo->zoom, cmd->tmpImage->height * photo->zoom));
-							} else {
+								photo->y + cursor_pos.y + (content_region.y - photo->image->height * photo->zoom) * 0.5f);
+							ImGui::SetCursorPos(origin);
+							Rect viewport{(int)std::floor((cursor_pos.x - origin.x) / photo->zoom),
+										  (int)std::floor((cursor_pos.y - origin.y) / photo->zoom),
+										  (int)std::ceil(content_region.x / photo->zoom) + 1,
+										  (int)std::ceil(content_region.y / photo->zoom) + 1};
+							if (!photo->loaded()) {
+								ImGui::Dummy(
+									ImVec2(photo->image->width * photo->zoom, photo->image->height * photo->zoom));
+								float progress =
+									photo->pending_load ? photo->pending_load->progress.load() : 0.0f;
+								DrawSpinner(ImGui::GetItemRectMin(), ImGui::GetItemRectMax(), progress);
+								app.request_frames(1);
+							} else if (photo->suspended()) {
+								Image *placeholder = photo->placeholder();
+								if (placeholder->texture == 0) {
+									placeholder->load_texture();
+								}
 								ImGui::Image(
-									(void *)(intptr_t)photo->image->texture,
+									(void *)(intptr_t)placeholder->texture,
 									ImVec2(photo->image->width * photo->zoom, photo->image->height * photo->zoom));
+							} else if (cmd && cmd->tmpImage) {
+								ImVec2 offset = cmd->previewOffset(photo->zoom);
+								if (cmd->isPreviewPartial()) {
+									photo->draw(viewport);
+									ImGui::SetCursorPos(ImVec2(origin.x + offset.x, origin.y + offset.y));
+								}
+								ImGui::Image((void *)(intptr_t)cmd->tmpImage->texture, cmd->previewSize(photo->zoom));
+								cmd->setZoom(photo->zoom);
+								cmd->setViewport(viewport);
+							} else {
+								photo->draw(viewport);
+								if (cmd) {
+									cmd->drawOverlay(ImGui::GetWindowDrawList(), ImGui::GetItemRectMin(), photo->zoom);
+								}
 							}
 						}
 						ImGui::EndChild();
@@ -121,8 +186,14 @@ int main(int argc, char *argv[]) try {
 				delete cmd;
 				cmd = nullptr;
 			} else if (cmd) {
+				double start = Stats::now();
+				double megapixels = photo->image->width * photo->image->height / 1e6;
 				cmd->showOptionsMenu();
+				if (cmd->done) {
+					app.command_timings[cmd->getInfo().ty].add(Stats::now() - start, megapixels);
+				}
 			} else {
+				ImGui::BeginDisabled(!photo->ready());
 				ImGui::BeginDisabled(!photo->can_undo_change());
 				if (ImGui::Button(ICON_MD_UNDO " Undo")) {
 					input_req.ty = InputRequest_Undo;
@@ -144,27 +215,34 @@ int main(int argc, char *argv[]) try {
 				for (size_t i = 0; i < Commands::number; i++) {
 					if (ImGui::Button(Commands::names[i], button_size)) {
 						cmd = Commands::factory[i]();
+						cmd->assets = &app.assets;
+						cmd->pyramid = &photo->pyramid;
+						cmd->setZoom(photo->zoom);
+						photo->begin_change((Commands::Type)i);
+						double start = Stats::now();
+						double megapixels = photo->image->width * photo->image->height / 1e6;
 						cmd->setImage(*photo->image);
 						if (!cmd->hasOptionsMenu()) {
+							app.command_timings[i].add(Stats::now() - start, megapixels);
 							photo->push_change(cmd->getInfo());
 							delete cmd;
 							cmd = nullptr;
 						}
 					}
 				}
+				ImGui::EndDisabled();
 			}
 		}
 		ImGui::End();
 
-		if (input_req.ty == InputRequest_SaveAs) {
+		if (!photo->ready()) {
+			// Still loading, or restored after this frame; its buttons are disabled until then.
+		} else if (cmd != nullptr && (input_req.ty == InputRequest_Undo || input_req.ty == InputRequest_Redo)) {
+			// The open command remembered the image as it was when it started, which is what its step gets undone to.
+		} else if (input_req.ty == InputRequest_SaveAs) {
 			app.save_file_dialog(*photo);
 		} else if (input_req.ty == InputRequest_Save) {
-			photo->image->save(photo->filepath.c_str());
-			delete photo->origImage;
-			photo->origImage = new Image(photo->image->width, photo->image->height, photo->image->channels);
-			memcpy(photo->origImage->data, photo->image->data,
-				   photo->image->width * photo->image->height * photo->image->channels);
-			photo->soft_reset();
+			app.save_photo(*photo, photo->filepath);
 		} else if (input_req.ty == InputRequest_Undo && photo->can_undo_change()) {
 			photo->undo_change();
 		} else if (input_req.ty == InputRequest_Redo && photo->can_redo_change()) {
@@ -172,6 +250,7 @@ int main(int argc, char *argv[]) try {
 		}
 
 		app.render();
+		app.update_residency(cmd == nullptr);
 	}
 
 	if (cmd != nullptr) {
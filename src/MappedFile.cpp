@@ -0,0 +1,348 @@
+#include "MappedFile.hpp"
+#include "Stats.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <unordered_map>
+
+#ifdef _WIN32
+#ifndef __MINGW32__
+#include <Windows.h>
+#else
+#include <windows.h>
+#endif // __MINGW32_
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace ayin;
+
+// Memory handed out by MappedFile::allocate(), so deallocate() can tell it apart from heap memory.
+static std::mutex s_allocationsMutex;
+static std::unordered_map<void *, MappedFile *> s_allocations;
+
+MappedFile::~MappedFile() { close(); }
+
+unsigned char *MappedFile::allocate(size_t size) {
+	auto file = std::make_unique<MappedFile>();
+	if (!file->create_writable_temp(temp_directory(), size)) {
+		return nullptr;
+	}
+	unsigned char *data = file->m_data;
+	std::lock_guard lock(s_allocationsMutex);
+	s_allocations.emplace(data, file.release());
+	return data;
+}
+
+unsigned char *MappedFile::map_copy(const char *filename, uint64_t offset, size_t size) {
+	auto file = std::make_unique<MappedFile>();
+	unsigned char *data = file->open_copy(filename, offset, size);
+	if (data == nullptr) {
+		return nullptr;
+	}
+	std::lock_guard lock(s_allocationsMutex);
+	s_allocations.emplace(data, file.release());
+	return data;
+}
+
+bool MappedFile::deallocate(void *data) {
+	if (data == nullptr) {
+		return false;
+	}
+	MappedFile *file = nullptr;
+	{
+		std::lock_guard lock(s_allocationsMutex);
+		auto it = s_allocations.find(data);
+		if (it == s_allocations.end()) {
+			return false;
+		}
+		file = it->second;
+		s_allocations.erase(it);
+	}
+	delete file;
+	return true;
+}
+
+bool FileContents::read(const char *filename) {
+	double start = Stats::now();
+	m_buffer.clear();
+	if (m_file.open(filename)) {
+		m_file.advise_sequential();
+		// Fault the pages in here rather than in the decoder, so the time splits cleanly between I/O and decoding.
+		volatile unsigned char sink = 0;
+		for (size_t i = 0; i < m_file.size(); i += 4096) {
+			sink = sink + m_file.data()[i];
+		}
+	} else {
+		std::ifstream file(filename, std::ios::binary);
+		if (!file) {
+			return false;
+		}
+		m_buffer.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+		if (m_buffer.empty()) {
+			return false;
+		}
+	}
+	Stats::add_input_read(size(), Stats::now() - start);
+	return true;
+}
+
+std::string MappedFile::temp_directory() {
+	if (const char *dir = std::getenv(AYIN_MAPPEDFILE_TEMP_DIR_ENV); dir != nullptr && *dir != '\0') {
+		return dir;
+	}
+	std::error_code ec;
+	std::filesystem::path path = std::filesystem::temp_directory_path(ec);
+	return ec ? std::string(".") : path.string();
+}
+
+#ifdef _WIN32
+
+bool MappedFile::open(const char *filename) {
+	close();
+	std::wstring path = std::filesystem::u8path(filename).wstring();
+	HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+							  FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+	LARGE_INTEGER size;
+	if (GetFileType(file) != FILE_TYPE_DISK || !GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+		CloseHandle(file);
+		return false;
+	}
+	HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	void *data = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+	if (data == nullptr) {
+		if (mapping) {
+			CloseHandle(mapping);
+		}
+		CloseHandle(file);
+		return false;
+	}
+	m_file = file;
+	m_mapping = mapping;
+	m_data = (unsigned char *)data;
+	m_size = (size_t)size.QuadPart;
+	return true;
+}
+
+bool MappedFile::create_temp(const std::string &dir, const void *data, size_t size) {
+	static std::atomic<unsigned int> counter{0};
+	close();
+	if (size == 0) {
+		return false;
+	}
+	std::filesystem::path path = std::filesystem::u8path(dir) /
+								 ("ayin-" + std::to_string(GetCurrentProcessId()) + "-" + std::to_string(counter++));
+	HANDLE file = CreateFileW(path.wstring().c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_NEW,
+							  FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, nullptr);
+	if (file == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+	const char *src = (const char *)data;
+	for (size_t written = 0; written < size;) {
+		DWORD chunk = (DWORD)std::min<size_t>(size - written, 1 << 30), n = 0;
+		if (!WriteFile(file, src + written, chunk, &n, nullptr) || n == 0) {
+			CloseHandle(file);
+			return false;
+		}
+		written += n;
+	}
+	HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	void *view = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+	if (view == nullptr) {
+		if (mapping) {
+			CloseHandle(mapping);
+		}
+		CloseHandle(file);
+		return false;
+	}
+	m_file = file;
+	m_mapping = mapping;
+	m_data = (unsigned char *)view;
+	m_size = size;
+	return true;
+}
+
+bool MappedFile::create_writable_temp(const std::string &dir, size_t size) {
+	static std::atomic<unsigned int> counter{0};
+	close();
+	if (size == 0) {
+		return false;
+	}
+	std::filesystem::path path = std::filesystem::u8path(dir) / ("ayin-" + std::to_string(GetCurrentProcessId()) +
+																 "-image-" + std::to_string(counter++));
+	HANDLE file = CreateFileW(path.wstring().c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_NEW,
+							  FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, nullptr);
+	if (file == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+	HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_READWRITE, (DWORD)((uint64_t)size >> 32),
+										(DWORD)(size & 0xffffffff), nullptr);
+	void *view = mapping ? MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, 0) : nullptr;
+	if (view == nullptr) {
+		if (mapping) {
+			CloseHandle(mapping);
+		}
+		CloseHandle(file);
+		return false;
+	}
+	m_file = file;
+	m_mapping = mapping;
+	m_data = (unsigned char *)view;
+	m_size = size;
+	return true;
+}
+
+unsigned char *MappedFile::open_copy(const char *, uint64_t, size_t) { return nullptr; }
+
+void MappedFile::close() {
+	if (m_data != nullptr) {
+		UnmapViewOfFile(m_data);
+		CloseHandle(m_mapping);
+		CloseHandle(m_file);
+	}
+	m_data = nullptr;
+	m_size = 0;
+	m_file = nullptr;
+	m_mapping = nullptr;
+}
+
+// The file is opened with FILE_FLAG_SEQUENTIAL_SCAN, which covers the mapping's read-ahead as well.
+void MappedFile::advise_sequential() const {}
+
+#else
+
+bool MappedFile::open(const char *filename) {
+	close();
+	int fd = ::open(filename, O_RDONLY);
+	if (fd < 0) {
+		return false;
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+		::close(fd);
+		return false;
+	}
+	void *data = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if (data == MAP_FAILED) {
+		return false;
+	}
+	m_data = (unsigned char *)data;
+	m_size = (size_t)st.st_size;
+	return true;
+}
+
+bool MappedFile::create_temp(const std::string &dir, const void *data, size_t size) {
+	close();
+	if (size == 0) {
+		return false;
+	}
+	std::string path = dir + "/ayin-XXXXXX";
+	int fd = mkstemp(path.data());
+	if (fd < 0) {
+		return false;
+	}
+	unlink(path.c_str());
+	const char *src = (const char *)data;
+	for (size_t written = 0; written < size;) {
+		ssize_t n = write(fd, src + written, size - written);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			::close(fd);
+			return false;
+		}
+		written += (size_t)n;
+	}
+	void *view = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+	::close(fd);
+	if (view == MAP_FAILED) {
+		return false;
+	}
+	m_data = (unsigned char *)view;
+	m_size = size;
+	return true;
+}
+
+bool MappedFile::create_writable_temp(const std::string &dir, size_t size) {
+	close();
+	if (size == 0) {
+		return false;
+	}
+	std::string path = dir + "/ayin-XXXXXX";
+	int fd = mkstemp(path.data());
+	if (fd < 0) {
+		return false;
+	}
+	unlink(path.c_str());
+	// The blocks are reserved up front: a sparse file would raise SIGBUS on a write into the mapping once the file
+	// system fills up, instead of failing here, where allocate() can fall back to the heap.
+	void *view = posix_fallocate(fd, 0, (off_t)size) == 0
+					 ? mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)
+					 : MAP_FAILED;
+	::close(fd);
+	if (view == MAP_FAILED) {
+		return false;
+	}
+	m_data = (unsigned char *)view;
+	m_size = size;
+	return true;
+}
+
+unsigned char *MappedFile::open_copy(const char *filename, uint64_t offset, size_t size) {
+	close();
+	int fd = ::open(filename, O_RDONLY);
+	if (fd < 0) {
+		return nullptr;
+	}
+	struct stat st;
+	if (size == 0 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || offset > (uint64_t)st.st_size ||
+		size > (uint64_t)st.st_size - offset) {
+		::close(fd);
+		return nullptr;
+	}
+	// mmap takes offsets in whole pages.
+	uint64_t page = (uint64_t)sysconf(_SC_PAGESIZE);
+	size_t skip = (size_t)(offset % page);
+	void *view = mmap(nullptr, skip + size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, (off_t)(offset - skip));
+	::close(fd);
+	if (view == MAP_FAILED) {
+		return nullptr;
+	}
+	m_data = (unsigned char *)view;
+	m_size = skip + size;
+	return m_data + skip;
+}
+
+void MappedFile::close() {
+	if (m_data != nullptr) {
+		munmap(m_data, m_size);
+	}
+	m_data = nullptr;
+	m_size = 0;
+}
+
+void MappedFile::advise_sequential() const {
+	if (m_data != nullptr) {
+		posix_madvise(m_data, m_size, POSIX_MADV_SEQUENTIAL);
+	}
+}
+
+#endif
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#ifndef AYIN_MAPPEDFILE_TEMP_DIR_ENV
+#define AYIN_MAPPEDFILE_TEMP_DIR_ENV "AYIN_TMPDIR"
+#endif
+
+namespace ayin {
+// A read-only memory mapping of a file. The OS pages the contents in on demand and may drop them again under memory
+// pressure, so a mapping costs address space rather than resident memory.
+class MappedFile {
+public:
+	MappedFile() = default;
+	MappedFile(const MappedFile &) = delete;
+	MappedFile &operator=(const MappedFile &) = delete;
+	~MappedFile();
+
+	// Maps an existing file. Fails for empty files and for anything that is not a regular file.
+	bool open(const char *filename);
+	// Writes size bytes of data to a new temporary file in dir and maps it. The file is removed from the directory
+	// right away (or on close on Windows), so it never outlives the mapping.
+	bool create_temp(const std::string &dir, const void *data, size_t size);
+	void close();
+	// Tells the OS the mapping will be read front to back, so it reads ahead aggressively and drops pages behind.
+	void advise_sequential() const;
+
+	const unsigned char *data() const { return m_data; }
+	size_t size() const { return m_size; }
+	bool is_open() const { return m_data != nullptr; }
+
+	// The directory temporary files go to: $AYIN_TMPDIR if set, the system temporary directory otherwise.
+	static std::string temp_directory();
+	// Zeroed, writable memory backed by a new temporary file in temp_directory() rather than by RAM and swap, so the
+	// OS can write it out and drop it under memory pressure. Returns nullptr on failure.
+	static unsigned char *allocate(size_t size);
+	// Writable memory holding size bytes of filename from offset, paged in from the file on demand. Writes stay
+	// private to the process (copy-on-write), and the file must not be changed in place while the memory is in use;
+	// replacing it with a new file is fine. Returns nullptr on failure, and always on Windows, where a mapped file
+	// cannot be replaced.
+	static unsigned char *map_copy(const char *filename, uint64_t offset, size_t size);
+	// Releases memory from allocate() or map_copy(). Returns false, doing nothing, if data came from neither.
+	static bool deallocate(void *data);
+
+private:
+	// Like create_temp(), but the mapping is writable and starts out zeroed.
+	bool create_writable_temp(const std::string &dir, size_t size);
+	// Maps the pages holding size bytes of filename from offset copy-on-write. Returns where offset lies in them.
+	unsigned char *open_copy(const char *filename, uint64_t offset, size_t size);
+
+	unsigned char *m_data = nullptr;
+	size_t m_size = 0;
+#ifdef _WIN32
+	void *m_file = nullptr;
+	void *m_mapping = nullptr;
+#endif
+};
+
+// The contents of an input file, mapped when it is a regular file and read into memory otherwise (pipes, devices,
+// /dev/stdin). The bytes and the time spent getting them into memory are added to Stats.
+class FileContents {
+public:
+	bool read(const char *filename);
+
+	const unsigned char *data() const { return m_file.is_open() ? m_file.data() : m_buffer.data(); }
+	size_t size() const { return m_file.is_open() ? m_file.size() : m_buffer.size(); }
+
+private:
+	MappedFile m_file;
+	std::vector<unsigned char> m_buffer;
+};
+} // namespace ayin
@@ -1,144 +1,253 @@
 #include "Photo.hpp"
-#include "ImageFilter.hpp"
+#include "Stats.hpp"
+
+#include <algorithm>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
 
 using namespace ayin;
 
-static void doCommand(Image &image, Commands::Info cmd) {
-	switch (cmd.ty) {
-	case Commands::Type_Grayscale:
-		ImageFilter::Grayscale(image);
-		break;
-	case Commands::Type_BlackAndWhite:
-		ImageFilter::BlackAndWhite(image);
-		break;
-	case Commands::Type_Invert:
-		ImageFilter::Invert(image);
-		break;
-	case Commands::Type_Merge: {
-		Image *image2 = new Image();
-		image2->load(cmd.merge_image);
-		ImageFilter::Merge(image, *image2);
-		delete image2;
-		break;
-	}
-	case Commands::Type_FlipHorizontally:
-		ImageFilter::FlipHorizontally(image);
-		break;
-	case Commands::Type_FlipVertically:
-		ImageFilter::FlipVertically(image);
-		break;
-	case Commands::Type_Rotate:
-		ImageFilter::Rotate(image);
-		break;
-	case Commands::Type_DarkenAndLighten:
-		ImageFilter::ChangeBrightness(image, cmd.darkenlighten_factor);
-		break;
-	case Commands::Type_Crop:
-		ImageFilter::Crop(image, cmd.crop_x, cmd.crop_y, cmd.crop_width, cmd.crop_height);
-		break;
-	case Commands::Type_Frame:
-		ImageFilter::Frame(image, cmd.frame_fanciness, cmd.frame_color);
-		break;
-	case Commands::Type_DetectEdges:
-		ImageFilter::DetectEdges(image);
-		break;
-	case Commands::Type_Resize:
-		ImageFilter::Resize(image, cmd.resize_width, cmd.resize_height);
-		break;
-	case Commands::Type_Blur:
-		ImageFilter::Blur(image, cmd.blur_level);
-		break;
-	case Commands::Type_Sunlight:
-		ImageFilter::Sunlight(image);
-		break;
-	case Commands::Type_OilPaint:
-		ImageFilter::OilPaint(image);
-		break;
-	case Commands::Type_Purple:
-		ImageFilter::Purple(image);
-		break;
-	case Commands::Type_Infrared:
-		ImageFilter::Infrared(image);
-		break;
-	case Commands::Type_Skew:
-		ImageFilter::Skew(image, cmd.skew_angle);
-		break;
-	case Commands::Type_Glasses3D:
-		ImageFilter::Glasses3D(image, cmd.darkenlighten_factor);
-		break;
-	case Commands::Type_MotionBlur:
-		ImageFilter::MotionBlur(image, cmd.blur_level);
-		break;
-	case Commands::Type_Emboss:
-		ImageFilter::Emboss(image);
-		break;
+Photo::~Photo() {
+	delete image;
+	delete origImage;
+	delete m_before;
+}
+
+// Gives image the requested dimensions, recreating its buffer if they differ.
+void Photo::reallocate(int width, int height, int channels) {
+	if (image->width == width && image->height == height && image->channels == channels) {
+		return;
 	}
+	delete image;
+	image = new Image(width, height, channels);
 }
 
-void Photo::reset() {
-	bool newDataSize = image->width != origImage->width || image->height != origImage->height;
-	if (newDataSize) {
-		newDataSize = true;
-		delete image;
-		image = new Image(origImage->width, origImage->height, origImage->channels);
-	}
-	memcpy(image->data, origImage->data, origImage->width * origImage->height * origImage->channels);
-	if (newDataSize) {
-		image->load_texture();
-	} else {
-		image->update_texture();
+void Photo::drop_steps(size_t first) {
+	for (size_t i = first; i < m_undoStack.size(); ++i) {
+		const Commands::Info &info = m_undoStack[i].info;
+		m_droppedMerges = m_droppedMerges || (info.ty == Commands::Type_Merge && info.merge_image != nullptr);
 	}
+	m_undoStack.resize(std::min(first, m_undoStack.size()));
+}
+
+bool Photo::take_dropped_merges() {
+	bool dropped = m_droppedMerges;
+	m_droppedMerges = false;
+	return dropped;
+}
+
+void Photo::reset() {
+	reallocate(origImage->width, origImage->height, origImage->channels);
+	memcpy(image->data, origImage->data, (size_t)origImage->width * origImage->height * origImage->channels);
 	m_undoPos = 0;
-	m_undoStack.clear();
+	drop_steps(0);
+	pyramid.invalidate();
+	++m_version;
 }
 
 void Photo::soft_reset() {
 	m_undoPos = 0;
-	m_undoStack.clear();
+	drop_steps(0);
+	delete m_before;
+	m_before = nullptr;
+}
+
+void Photo::begin_change(Commands::Type type) {
+	delete m_before;
+	m_before = Commands::Info(type).has_inverse() ? nullptr : new Image(*image);
 }
 
 void Photo::push_change(Commands::Info info) {
 	if (m_undoPos != 0) {
-		m_undoStack.resize(m_undoStack.size() - m_undoPos);
+		drop_steps(m_undoStack.size() - m_undoPos);
 		m_undoPos = 0;
 	}
-	m_undoStack.push_back(info);
+	Step step{info, nullptr};
+	if (m_before != nullptr && !info.has_inverse()) {
+		if (m_before->width == image->width && m_before->height == image->height &&
+			m_before->channels == image->channels) {
+			step.snapshot = std::make_unique<Snapshot>(*image, *m_before);
+		} else {
+			step.snapshot = std::make_unique<Snapshot>(*m_before);
+		}
+	}
+	delete m_before;
+	m_before = nullptr;
+	m_undoStack.push_back(std::move(step));
+	++m_version;
 }
 
 void Photo::undo_change() {
+	Stats::Timer timer(Stats::undo);
 	++m_undoPos;
+	++m_version;
+	pyramid.invalidate();
 
-	bool newDataSize = image->width != origImage->width || image->height != origImage->height;
-	if (newDataSize) {
-		newDataSize = true;
-		delete image;
-		image = new Image(origImage->width, origImage->height, origImage->channels);
+	Step &step = m_undoStack[m_undoStack.size() - m_undoPos];
+	if (step.info.has_inverse()) {
+		Commands::apply(*image, step.info.inverse());
+		return;
 	}
 
-	memcpy(image->data, origImage->data, origImage->width * origImage->height * origImage->channels);
+	Snapshot *snapshot = step.snapshot.get();
+	bool instantRedo = snapshot != nullptr && snapshot->is_delta() && !snapshot->evicted();
+	if (!instantRedo && step.info.estimated_cost(image->width, image->height) >= AYIN_PHOTO_REDO_CACHE_MIN_COST) {
+		step.redo = std::make_unique<Snapshot>(*image);
+	}
 
-	for (size_t i = 0; i < m_undoStack.size() - m_undoPos; ++i) {
-		doCommand(*image, m_undoStack[i]);
+	if (snapshot != nullptr && !snapshot->evicted()) {
+		reallocate(snapshot->width, snapshot->height, snapshot->channels);
+		snapshot->apply(*image);
+		return;
 	}
 
-	if (newDataSize) {
-		image->load_texture();
-	} else {
-		image->update_texture();
+	// Snapshot was evicted (or never taken): replay the history from the original.
+	reallocate(origImage->width, origImage->height, origImage->channels);
+	memcpy(image->data, origImage->data, (size_t)origImage->width * origImage->height * origImage->channels);
+
+	for (size_t i = 0; i < m_undoStack.size() - m_undoPos; ++i) {
+		Commands::apply(*image, m_undoStack[i].info);
 	}
 }
 
 bool Photo::can_undo_change() { return m_undoPos <= (int)m_undoStack.size() - 1; }
 
 void Photo::redo_change() {
+	Stats::Timer timer(Stats::redo);
 	--m_undoPos;
-	int width = image->width, height = image->height;
-	doCommand(*image, m_undoStack[m_undoStack.size() - m_undoPos - 1]);
-	if (width == image->width && height == image->height) {
-		image->update_texture();
-	} else {
-		image->load_texture();
+	++m_version;
+	pyramid.invalidate();
+	Step &step = m_undoStack[m_undoStack.size() - m_undoPos - 1];
+	if (step.redo != nullptr && !step.redo->evicted()) {
+		reallocate(step.redo->width, step.redo->height, step.redo->channels);
+		step.redo->apply(*image);
+		step.redo.reset();
+		return;
+	}
+	step.redo.reset();
+	if (step.snapshot != nullptr && step.snapshot->is_delta() && !step.snapshot->evicted()) {
+		step.snapshot->apply(*image);
+		return;
 	}
+	Commands::apply(*image, step.info);
 }
 
 bool Photo::can_redo_change() { return m_undoPos != 0; }
+
+void Photo::draw(Rect visible) {
+	m_lastShown = Stats::now();
+	ImVec2 pos = ImGui::GetCursorScreenPos();
+	ImVec2 size(image->width * zoom, image->height * zoom);
+	pyramid.draw(*image, Pyramid::level_for_scale(zoom), ImGui::GetWindowDrawList(), pos, size, visible);
+	ImGui::Dummy(size);
+}
+
+void Photo::finish_loading(Image *decoded, double time, bool history_follows) {
+	delete image;
+	image = decoded;
+	if (!history_follows) {
+		delete origImage;
+		origImage = new Image(*decoded);
+	}
+	pyramid.clear();
+	m_loaded = true;
+	m_awaitingHistory = history_follows;
+	m_loadTime = time;
+	++m_version;
+}
+
+std::vector<Commands::Info> Photo::history() const {
+	std::vector<Commands::Info> steps;
+	for (const Step &step : m_undoStack) {
+		steps.push_back(step.info);
+	}
+	return steps;
+}
+
+void Photo::restore_history(Image *original, std::vector<Commands::Info> steps, int undoPosition) {
+	delete origImage;
+	origImage = original;
+	drop_steps(0);
+	for (const Commands::Info &info : steps) {
+		m_undoStack.push_back(Step{info, nullptr});
+	}
+	m_undoPos = std::clamp(undoPosition, 0, (int)m_undoStack.size());
+	m_awaitingHistory = false;
+	++m_version;
+}
+
+bool Photo::finish_saving(PendingSave &save) {
+	if (!save.ok || save.original != nullptr || save.version != m_version || !ready()) {
+		return false;
+	}
+	delete origImage;
+	origImage = save.image.release();
+	soft_reset();
+	++m_version;
+	return true;
+}
+
+void Photo::unload_textures() { pyramid.unload_textures(); }
+
+void Photo::suspend() {
+	if (!ready()) {
+		return;
+	}
+	m_placeholder = std::make_unique<Image>(pyramid.level(*image, INT_MAX));
+	m_suspendedImage = std::make_unique<Snapshot>(*image, true);
+	if (origImage->width == image->width && origImage->height == image->height &&
+		origImage->channels == image->channels) {
+		m_suspendedOrigImage = std::make_unique<Snapshot>(*origImage, *image, true);
+	} else {
+		m_suspendedOrigImage = std::make_unique<Snapshot>(*origImage, true);
+	}
+	unload_textures();
+	pyramid.clear();
+	for (Image *img : {image, origImage}) {
+		Image::free_data(img->data);
+		img->data = nullptr;
+	}
+}
+
+bool Photo::resume() {
+	if (!suspended()) {
+		return true;
+	}
+	image->data = Image::allocate_data((size_t)image->width * image->height * image->channels);
+	origImage->data = Image::allocate_data((size_t)origImage->width * origImage->height * origImage->channels);
+	bool ok = m_suspendedImage->apply(*image);
+	if (m_suspendedOrigImage->is_delta()) {
+		memcpy(origImage->data, image->data, (size_t)image->width * image->height * image->channels);
+	}
+	ok = m_suspendedOrigImage->apply(*origImage) && ok;
+	m_suspendedImage.reset();
+	m_suspendedOrigImage.reset();
+	m_placeholder.reset();
+	return ok;
+}
+
+size_t Photo::texture_size() const {
+	size_t size = pyramid.texture_size();
+	if (m_placeholder && m_placeholder->texture) {
+		size += (size_t)m_placeholder->width * m_placeholder->height * m_placeholder->channels;
+	}
+	return size;
+}
+
+size_t Photo::pixel_size() const {
+	if (!ready()) {
+		return 0;
+	}
+	return pyramid.size() + (size_t)image->width * image->height * image->channels +
+		   (size_t)origImage->width * origImage->height * origImage->channels;
+}
+
+size_t Photo::history_size() const {
+	size_t size = 0;
+	for (const Step &step : m_undoStack) {
+		size += step.snapshot ? step.snapshot->size() : 0;
+		size += step.redo ? step.redo->size() : 0;
+	}
+	return size;
+}
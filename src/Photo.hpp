@@ -2,10 +2,54 @@
 
 #include "Commands.hpp"
 #include "Image.hpp"
+#include "Project.hpp"
+#include "Pyramid.hpp"
+#include "Snapshot.hpp"
 
+#include <atomic>
+#include <memory>
 #include <string>
 
+// Undoing a step whose Commands::Info::estimated_cost() reaches this many milliseconds keeps the state it undid, so
+// that redoing it does not run the command again.
+#ifndef AYIN_PHOTO_REDO_CACHE_MIN_COST
+#define AYIN_PHOTO_REDO_CACHE_MIN_COST 30.0
+#endif
+
 namespace ayin {
+// Pixels of a photo being decoded on a worker thread.
+struct PendingLoad {
+	std::atomic<bool> done = false;
+	// Decoded pixels, or nullptr if decoding failed.
+	Image *image = nullptr;
+	// Set once image can be shown, for project files, whose history is still being decoded until done.
+	std::atomic<bool> image_loaded = false;
+	// For project files, everything but image, which is moved out of it; nullptr if the file could not be read.
+	std::unique_ptr<Project::Contents> project{};
+	// Decoding time in milliseconds.
+	double time = 0.0;
+	// Fraction decoded so far, for decoders that report it.
+	std::atomic<float> progress = 0.0f;
+	// Set when the result is no longer wanted; a decode that has not started yet is skipped.
+	std::atomic<bool> cancelled = false;
+
+	~PendingLoad() { delete image; }
+};
+
+// A copy of a photo's image being written to a file on a worker thread, so editing can go on meanwhile.
+struct PendingSave {
+	std::atomic<bool> done = false;
+	bool ok = false;
+	std::string filepath{};
+	std::unique_ptr<Image> image{};
+	// For project files, the original image and the history as well.
+	std::unique_ptr<Image> original{};
+	std::vector<Commands::Info> steps{};
+	int undo_position = 0;
+	// Photo::version() when the save started.
+	unsigned int version = 0;
+};
+
 class Photo {
 public:
 	Image *image = nullptr;
@@ -13,18 +57,98 @@ public:
 	std::string name{};
 	std::string filepath{};
 	float x = 0.0f, y = 0.0f, zoom = 1.0f;
+	Pyramid pyramid{};
+	// Set while Application decodes the file.
+	std::shared_ptr<PendingLoad> pending_load{};
+	// Set while Application writes the image to a file.
+	std::shared_ptr<PendingSave> pending_save{};
 
 	Photo() = default;
+	~Photo();
 	void reset();
 	void soft_reset();
+	// Remembers the current image so the next push_change() can store the step as a compressed snapshot. Commands of
+	// type that have an exact inverse are undone by applying it, so nothing is remembered for them.
+	void begin_change(Commands::Type type);
+	// Records the change a command made to image. The command has already invalidated the parts of pyramid it
+	// changed.
 	void push_change(Commands::Info info);
 	void undo_change();
 	bool can_undo_change();
 	void redo_change();
 	bool can_redo_change();
+	// Changes whenever image or the history changes, so a finished save can tell whether it wrote the current image.
+	unsigned int version() const { return m_version; }
+	// True if steps with a Merge image left the history (through a new step replacing undone ones, a reset or a new
+	// original) since the last call, so the image may no longer be needed.
+	bool take_dropped_merges();
+	// The commands of the history, oldest first, and how many of them at the end are undone.
+	std::vector<Commands::Info> history() const;
+	int undo_position() const { return m_undoPos; }
+	// Replaces origImage, taking ownership of original, and the history with the ones read from a project file. The
+	// steps have no snapshots, so undoing replays them from the original.
+	void restore_history(Image *original, std::vector<Commands::Info> steps, int undoPosition);
+	// Makes the image a finished save wrote the new original, clearing the history, if nothing changed since the save
+	// started. Project saves keep the history, so they never do. Returns false if the original was kept.
+	bool finish_saving(PendingSave &save);
+	// Draws image at the ImGui cursor at the current zoom, through the pyramid level that suits it. Only the tiles
+	// intersecting visible (in image pixels) are drawn, and uploaded if they changed. Must not be called while
+	// suspended.
+	void draw(Rect visible);
+
+	// Photos are opened from the file's header alone and decoded in the background. Until finish_loading(), image
+	// and origImage have the file's dimensions but no data.
+	bool loaded() const { return m_loaded; }
+	// Installs the decoded pixels, taking ownership of them. With history_follows, the original is left to
+	// restore_history() and the photo is not ready() until then.
+	void finish_loading(Image *decoded, double time, bool history_follows = false);
+	// Milliseconds it took to decode the file.
+	double load_time() const { return m_loadTime; }
+	// Loaded with its original and not suspended, so image and origImage hold the pixels.
+	bool ready() const { return m_loaded && !m_awaitingHistory && !suspended(); }
+
+	// Residency: photos that have not been shown for a while first give up their textures, which draw() recreates,
+	// and then their pixels, which suspend() keeps compressed (or spilled to disk) until resume(). While
+	// suspended, image and origImage keep their dimensions but have no data.
+	void unload_textures();
+	void suspend();
+	// Restores the pixels of a suspended photo. Returns false if they were lost.
+	bool resume();
+	bool suspended() const { return m_suspendedImage != nullptr; }
+	// Smallest pyramid level, kept while suspended to stand in for the image.
+	Image *placeholder() const { return m_placeholder.get(); }
+	// When draw() was last called, in Stats::now() milliseconds.
+	double last_shown() const { return m_lastShown; }
+	size_t texture_size() const;
+	size_t pixel_size() const;
+	// Bytes held by the history's snapshots.
+	size_t history_size() const;
 
 private:
-	std::vector<Commands::Info> m_undoStack{};
+	struct Step {
+		Commands::Info info;
+		// State before the step: a delta against the state after it, or a keyframe when the size changed.
+		std::unique_ptr<Snapshot> snapshot;
+		// State after the step, kept while it is undone if redoing it would be expensive.
+		std::unique_ptr<Snapshot> redo;
+	};
+
+	std::vector<Step> m_undoStack{};
 	int m_undoPos = 0;
+	Image *m_before = nullptr;
+	// While suspended: image as a keyframe, and origImage as a delta against it.
+	std::unique_ptr<Snapshot> m_suspendedImage{};
+	std::unique_ptr<Snapshot> m_suspendedOrigImage{};
+	std::unique_ptr<Image> m_placeholder{};
+	double m_lastShown = 0.0;
+	bool m_loaded = false;
+	bool m_awaitingHistory = false;
+	double m_loadTime = 0.0;
+	unsigned int m_version = 0;
+	bool m_droppedMerges = false;
+
+	void reallocate(int width, int height, int channels);
+	// Removes the steps from first on, noting whether a Merge image went with them.
+	void drop_steps(size_t first);
 };
 } // namespace ayin
@@ -0,0 +1,851 @@
+#include "Png.hpp"
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+
+using namespace ayin;
+
+namespace {
+const uint32_t AdlerBase = 65521;
+const int WindowSize = 32768;
+const int HashBits = 15;
+const int MaxMatch = 258;
+
+const int LengthBase[29] = {3,  4,  5,  6,  7,  8,  9,  10, 11,  13,  15,  17,  19,  23, 27,
+							31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+const int LengthExtra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+const int DistanceBase[30] = {1,   2,   3,   4,   5,   7,    9,    13,   17,   25,   33,   49,   65,    97,    129,
+							  193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+const int DistanceExtra[30] = {0, 0, 0, 0, 1, 1, 2, 2,  3,  3,  4,  4,  5,  5,  6,
+							   6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+uint32_t Reverse(uint32_t code, int bits) {
+	uint32_t reversed = 0;
+	for (int i = 0; i < bits; ++i, code >>= 1) {
+		reversed = (reversed << 1) | (code & 1);
+	}
+	return reversed;
+}
+
+// The fixed Huffman codes of deflate (RFC 1951, 3.2.6), bit-reversed since the stream is written LSB first, and the
+// length code of every match length.
+struct Tables {
+	uint16_t literal[288];
+	uint8_t literalBits[288];
+	uint8_t distance[30];
+	uint8_t lengthCode[MaxMatch + 1];
+	uint32_t crc[256];
+
+	Tables() {
+		for (int v = 0; v < 288; ++v) {
+			uint32_t code = v < 144 ? 0x30 + v : v < 256 ? 0x190 + v - 144 : v < 280 ? v - 256 : 0xc0 + v - 280;
+			int bits = v < 144 ? 8 : v < 256 ? 9 : v < 280 ? 7 : 8;
+			literal[v] = (uint16_t)Reverse(code, bits);
+			literalBits[v] = (uint8_t)bits;
+		}
+		for (int d = 0; d < 30; ++d) {
+			distance[d] = (uint8_t)Reverse(d, 5);
+		}
+		for (int code = 0, length = 3; length <= MaxMatch; ++length) {
+			while (code < 28 && length >= LengthBase[code + 1]) {
+				++code;
+			}
+			lengthCode[length] = (uint8_t)code;
+		}
+		for (uint32_t n = 0; n < 256; ++n) {
+			uint32_t c = n;
+			for (int k = 0; k < 8; ++k) {
+				c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+			}
+			crc[n] = c;
+		}
+	}
+};
+
+const Tables &GetTables() {
+	static const Tables tables;
+	return tables;
+}
+
+uint32_t Crc32(uint32_t crc, const unsigned char *data, size_t size) {
+	const Tables &tables = GetTables();
+	crc = ~crc;
+	for (size_t i = 0; i < size; ++i) {
+		crc = tables.crc[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+	}
+	return ~crc;
+}
+
+uint32_t Adler32(const unsigned char *data, size_t size) {
+	uint32_t a = 1, b = 0;
+	while (size > 0) {
+		// Largest run for which b cannot overflow before the modulo.
+		size_t n = std::min<size_t>(size, 5552);
+		for (size_t i = 0; i < n; ++i) {
+			a += data[i];
+			b += a;
+		}
+		a %= AdlerBase;
+		b %= AdlerBase;
+		data += n;
+		size -= n;
+	}
+	return a | (b << 16);
+}
+
+// Checksum of the concatenation of two pieces, given the checksum of each and the size of the second.
+uint32_t Adler32Combine(uint32_t adler1, uint32_t adler2, size_t size2) {
+	uint64_t rem = size2 % AdlerBase;
+	uint64_t a1 = adler1 & 0xffff, b1 = adler1 >> 16, a2 = adler2 & 0xffff, b2 = adler2 >> 16;
+	uint64_t a = (a1 + a2 + AdlerBase - 1) % AdlerBase;
+	uint64_t b = (b1 + b2 + rem * a1 + AdlerBase - rem) % AdlerBase;
+	return (uint32_t)(a | (b << 16));
+}
+
+void PutBigEndian(std::vector<unsigned char> &out, uint32_t value) {
+	out.push_back((unsigned char)(value >> 24));
+	out.push_back((unsigned char)(value >> 16));
+	out.push_back((unsigned char)(value >> 8));
+	out.push_back((unsigned char)value);
+}
+
+class BitWriter {
+public:
+	explicit BitWriter(std::vector<unsigned char> &out) : m_out(out) {}
+
+	void put(uint32_t value, int bits) {
+		m_bits |= (uint64_t)value << m_count;
+		m_count += bits;
+		while (m_count >= 8) {
+			m_out.push_back((unsigned char)m_bits);
+			m_bits >>= 8;
+			m_count -= 8;
+		}
+	}
+	void align() {
+		if (m_count > 0) {
+			m_out.push_back((unsigned char)m_bits);
+		}
+		m_bits = 0;
+		m_count = 0;
+	}
+
+private:
+	std::vector<unsigned char> &m_out;
+	uint64_t m_bits = 0;
+	int m_count = 0;
+};
+
+// Appends src as non-final deflate blocks followed by an empty stored block, so the output ends byte-aligned and
+// another piece of the stream can follow it.
+void Deflate(const unsigned char *src, size_t size, int level, std::vector<unsigned char> &out) {
+	BitWriter writer(out);
+	if (level == 0) {
+		for (size_t pos = 0; pos < size;) {
+			size_t n = std::min<size_t>(size - pos, 65535);
+			writer.put(0, 3);
+			writer.align();
+			out.push_back((unsigned char)n);
+			out.push_back((unsigned char)(n >> 8));
+			out.push_back((unsigned char)~n);
+			out.push_back((unsigned char)(~n >> 8));
+			out.insert(out.end(), src + pos, src + pos + n);
+			pos += n;
+		}
+		return;
+	}
+
+	const Tables &tables = GetTables();
+	auto literal = [&](int v) { writer.put(tables.literal[v], tables.literalBits[v]); };
+	auto hash = [&](size_t i) {
+		uint32_t v = src[i] | (uint32_t)src[i + 1] << 8 | (uint32_t)src[i + 2] << 16;
+		return (v * 2654435761u) >> (32 - HashBits);
+	};
+	std::vector<int32_t> head((size_t)1 << HashBits, -1);
+	std::vector<int32_t> prev(WindowSize);
+	auto insert = [&](size_t i) {
+		uint32_t h = hash(i);
+		prev[i & (WindowSize - 1)] = head[h];
+		head[h] = (int32_t)i;
+	};
+	const int maxChain = 1 << (level - 1);
+
+	// Fixed Huffman block, not the last one.
+	writer.put(2, 3);
+	for (size_t pos = 0; pos < size;) {
+		int bestLength = 0, bestDistance = 0;
+		if (pos + 3 <= size) {
+			int maxLength = (int)std::min<size_t>(MaxMatch, size - pos);
+			int32_t candidate = head[hash(pos)];
+			for (int chain = maxChain; candidate >= 0 && pos - candidate <= WindowSize && chain > 0; --chain) {
+				const unsigned char *a = src + candidate, *b = src + pos;
+				if (a[bestLength] == b[bestLength]) {
+					int length = 0;
+					while (length < maxLength && a[length] == b[length]) {
+						++length;
+					}
+					if (length > bestLength) {
+						bestLength = length;
+						bestDistance = (int)(pos - candidate);
+						if (length == maxLength) {
+							break;
+						}
+					}
+				}
+				candidate = prev[candidate & (WindowSize - 1)];
+			}
+			insert(pos);
+		}
+		// A short match far back costs more bits than its literals.
+		if (bestLength < 3 || (bestLength == 3 && bestDistance > 4096)) {
+			literal(src[pos]);
+			++pos;
+			continue;
+		}
+		int code = tables.lengthCode[bestLength];
+		literal(257 + code);
+		writer.put(bestLength - LengthBase[code], LengthExtra[code]);
+		code = (int)(std::upper_bound(DistanceBase, DistanceBase + 30, bestDistance) - DistanceBase) - 1;
+		writer.put(tables.distance[code], 5);
+		writer.put(bestDistance - DistanceBase[code], DistanceExtra[code]);
+		// The fast mode only indexes where matches start.
+		if (level > 1) {
+			for (size_t end = std::min(pos + bestLength, size - 2), i = pos + 1; i < end; ++i) {
+				insert(i);
+			}
+		}
+		pos += bestLength;
+	}
+	literal(256);
+
+	// Empty stored block: a sync flush.
+	writer.put(0, 3);
+	writer.align();
+	const unsigned char flush[4] = {0x00, 0x00, 0xff, 0xff};
+	out.insert(out.end(), flush, flush + 4);
+}
+
+int Paeth(int a, int b, int c) {
+	int p = a + b - c;
+	int pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+	return pa <= pb && pa <= pc ? a : pb <= pc ? b : c;
+}
+
+// Writes the filter type byte followed by row filtered with it. prev is the row above, all zeros for the first.
+void Filter(int type, const unsigned char *row, const unsigned char *prev, size_t stride, int bpp,
+			unsigned char *out) {
+	*out++ = (unsigned char)type;
+	for (size_t i = 0; i < stride; ++i) {
+		int a = i >= (size_t)bpp ? row[i - bpp] : 0, b = prev[i], c = i >= (size_t)bpp ? prev[i - bpp] : 0;
+		int predicted = 0;
+		switch (type) {
+		case 1:
+			predicted = a;
+			break;
+		case 2:
+			predicted = b;
+			break;
+		case 3:
+			predicted = (a + b) >> 1;
+			break;
+		case 4:
+			predicted = Paeth(a, b, c);
+			break;
+		}
+		out[i] = (unsigned char)(row[i] - predicted);
+	}
+}
+
+// Sum of the filtered bytes taken as signed, the usual estimate of how well a row will compress.
+size_t Cost(const unsigned char *filtered, size_t stride) {
+	size_t cost = 0;
+	for (size_t i = 0; i < stride; ++i) {
+		cost += (size_t)std::abs((int)(signed char)filtered[i]);
+	}
+	return cost;
+}
+
+void PutChunk(std::vector<unsigned char> &out, const char *type, const unsigned char *data, size_t size) {
+	PutBigEndian(out, (uint32_t)size);
+	size_t start = out.size();
+	out.insert(out.end(), type, type + 4);
+	out.insert(out.end(), data, data + size);
+	PutBigEndian(out, Crc32(0, out.data() + start, out.size() - start));
+}
+
+struct Strip {
+	// Complete IDAT chunk.
+	std::vector<unsigned char> chunk;
+	uint32_t adler = 1;
+	size_t size = 0;
+};
+
+// Canonical Huffman code for decoding, with a table for codes of up to FastBits bits.
+struct Huffman {
+	static const int FastBits = 9;
+	// (length << 9) | symbol for every FastBits-bit prefix of a short code, indexed LSB first; 0 for longer codes.
+	uint16_t fast[1 << FastBits];
+	uint16_t counts[16];
+	// Symbols ordered by code length, then value.
+	uint16_t symbols[320];
+
+	bool build(const uint8_t *lengths, int n) {
+		memset(counts, 0, sizeof(counts));
+		for (int i = 0; i < n; ++i) {
+			++counts[lengths[i]];
+		}
+		counts[0] = 0;
+		int left = 1, offsets[16] = {}, next[16] = {};
+		for (int length = 1; length < 16; ++length) {
+			left = (left << 1) - counts[length];
+			if (left < 0) {
+				return false;
+			}
+			if (length < 15) {
+				offsets[length + 1] = offsets[length] + counts[length];
+			}
+			next[length] = length == 1 ? 0 : (next[length - 1] + counts[length - 1]) << 1;
+		}
+		memset(fast, 0, sizeof(fast));
+		for (int symbol = 0; symbol < n; ++symbol) {
+			int length = lengths[symbol];
+			if (length == 0) {
+				continue;
+			}
+			symbols[offsets[length]++] = (uint16_t)symbol;
+			int code = next[length]++;
+			if (length <= FastBits) {
+				for (uint32_t i = Reverse(code, length); i < (1u << FastBits); i += 1u << length) {
+					fast[i] = (uint16_t)(length << 9 | symbol);
+				}
+			}
+		}
+		return true;
+	}
+};
+
+// Pull-based inflater: reads the zlib stream through read, and hands the output to write in pieces as the window
+// allows. Either callback returning 0 or false ends the stream.
+class Inflater {
+public:
+	using Read = std::function<size_t(unsigned char *, size_t)>;
+	using Write = std::function<bool(const unsigned char *, size_t)>;
+
+	Inflater(Read read, Write write)
+		: m_read(std::move(read)), m_write(std::move(write)), m_input(64 * 1024), m_output(4 * WindowSize) {}
+
+	bool run() {
+		int cmf = bits(8), flg = bits(8);
+		if ((cmf & 15) != 8 || (cmf >> 4) > 7 || (cmf * 256 + flg) % 31 != 0 || (flg & 32) != 0) {
+			return false;
+		}
+		for (bool last = false; !last;) {
+			last = bits(1) != 0;
+			int type = bits(2);
+			bool ok = false;
+			if (type == 0) {
+				ok = stored();
+			} else if (type == 1) {
+				static const FixedCodes fixed;
+				ok = codes(fixed.literal, fixed.distance);
+			} else if (type == 2) {
+				ok = dynamic();
+			}
+			if (!ok || m_padding > 8) {
+				return false;
+			}
+		}
+		return flush();
+	}
+
+private:
+	struct FixedCodes {
+		Huffman literal, distance;
+
+		FixedCodes() {
+			uint8_t lengths[288];
+			for (int v = 0; v < 288; ++v) {
+				lengths[v] = v < 144 ? 8 : v < 256 ? 9 : v < 280 ? 7 : 8;
+			}
+			literal.build(lengths, 288);
+			std::fill(lengths, lengths + 30, 5);
+			distance.build(lengths, 30);
+		}
+	};
+
+	Read m_read;
+	Write m_write;
+	std::vector<unsigned char> m_input;
+	size_t m_inputPos = 0, m_inputSize = 0;
+	// Zero bytes supplied past the end of the input; a few are normal while peeking at the last code.
+	int m_padding = 0;
+	uint64_t m_bits = 0;
+	int m_count = 0;
+	// The last WindowSize bytes of output, then the ones not yet written.
+	std::vector<unsigned char> m_output;
+	size_t m_pos = 0, m_flushed = 0;
+	uint64_t m_total = 0;
+
+	int byte() {
+		if (m_inputPos == m_inputSize) {
+			m_inputPos = 0;
+			m_inputSize = m_read(m_input.data(), m_input.size());
+			if (m_inputSize == 0) {
+				++m_padding;
+				return 0;
+			}
+		}
+		return m_input[m_inputPos++];
+	}
+	void need(int n) {
+		while (m_count < n) {
+			m_bits |= (uint64_t)byte() << m_count;
+			m_count += 8;
+		}
+	}
+	int bits(int n) {
+		need(n);
+		int value = (int)(m_bits & ((1ull << n) - 1));
+		m_bits >>= n;
+		m_count -= n;
+		return value;
+	}
+
+	int decode(const Huffman &huffman) {
+		need(16);
+		int entry = huffman.fast[m_bits & ((1 << Huffman::FastBits) - 1)];
+		if (entry != 0) {
+			m_bits >>= entry >> 9;
+			m_count -= entry >> 9;
+			return entry & 511;
+		}
+		int code = 0, first = 0, index = 0;
+		for (int length = 1; length < 16; ++length) {
+			code |= (int)(m_bits >> (length - 1)) & 1;
+			int count = huffman.counts[length];
+			if (code - count < first) {
+				m_bits >>= length;
+				m_count -= length;
+				return huffman.symbols[index + code - first];
+			}
+			index += count;
+			first = (first + count) << 1;
+			code <<= 1;
+		}
+		return -1;
+	}
+
+	bool flush() {
+		if (m_pos > m_flushed && !m_write(m_output.data() + m_flushed, m_pos - m_flushed)) {
+			return false;
+		}
+		if (m_pos == m_output.size()) {
+			memmove(m_output.data(), m_output.data() + m_pos - WindowSize, WindowSize);
+			m_pos = WindowSize;
+		}
+		m_flushed = m_pos;
+		return true;
+	}
+
+	bool stored() {
+		m_bits >>= m_count % 8;
+		m_count -= m_count % 8;
+		int length = bits(16), complement = bits(16);
+		if (length != (~complement & 0xffff)) {
+			return false;
+		}
+		for (int i = 0; i < length; ++i) {
+			if (m_pos == m_output.size() && !flush()) {
+				return false;
+			}
+			m_output[m_pos++] = (unsigned char)bits(8);
+		}
+		m_total += length;
+		return true;
+	}
+
+	bool dynamic() {
+		static const int order[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+		int literals = bits(5) + 257, distances = bits(5) + 1, codeLengths = bits(4) + 4;
+		if (literals > 286 || distances > 30) {
+			return false;
+		}
+		uint8_t lengths[320] = {};
+		for (int i = 0; i < codeLengths; ++i) {
+			lengths[order[i]] = (uint8_t)bits(3);
+		}
+		Huffman lengthCode;
+		if (!lengthCode.build(lengths, 19)) {
+			return false;
+		}
+		memset(lengths, 0, sizeof(lengths));
+		for (int i = 0; i < literals + distances;) {
+			int symbol = decode(lengthCode);
+			if (symbol < 0) {
+				return false;
+			}
+			if (symbol < 16) {
+				lengths[i++] = (uint8_t)symbol;
+				continue;
+			}
+			int value = 0, repeat;
+			if (symbol == 16) {
+				if (i == 0) {
+					return false;
+				}
+				value = lengths[i - 1];
+				repeat = 3 + bits(2);
+			} else {
+				repeat = symbol == 17 ? 3 + bits(3) : 11 + bits(7);
+			}
+			if (i + repeat > literals + distances) {
+				return false;
+			}
+			std::fill(lengths + i, lengths + i + repeat, (uint8_t)value);
+			i += repeat;
+		}
+		Huffman literal, distance;
+		return lengths[256] != 0 && literal.build(lengths, literals) && distance.build(lengths + literals, distances) &&
+			   codes(literal, distance);
+	}
+
+	bool codes(const Huffman &literal, const Huffman &distance) {
+		for (;;) {
+			int symbol = decode(literal);
+			if (symbol < 256) {
+				if (symbol < 0 || (m_pos == m_output.size() && !flush())) {
+					return false;
+				}
+				m_output[m_pos++] = (unsigned char)symbol;
+				++m_total;
+				continue;
+			}
+			if (symbol == 256) {
+				return true;
+			}
+			symbol -= 257;
+			if (symbol >= 29) {
+				return false;
+			}
+			int length = LengthBase[symbol] + bits(LengthExtra[symbol]);
+			symbol = decode(distance);
+			if (symbol < 0 || symbol >= 30) {
+				return false;
+			}
+			int offset = DistanceBase[symbol] + bits(DistanceExtra[symbol]);
+			if ((uint64_t)offset > m_total || m_padding > 8) {
+				return false;
+			}
+			for (int i = 0; i < length; ++i) {
+				if (m_pos == m_output.size() && !flush()) {
+					return false;
+				}
+				m_output[m_pos] = m_output[m_pos - offset];
+				++m_pos;
+			}
+			m_total += length;
+		}
+	}
+};
+
+uint32_t GetBigEndian(const unsigned char *p) {
+	return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+// Reverses the filter of row in place, given the unfiltered row above it.
+void Unfilter(int type, unsigned char *row, const unsigned char *prev, size_t size, int bpp) {
+	switch (type) {
+	case 1:
+		for (size_t i = bpp; i < size; ++i) {
+			row[i] += row[i - bpp];
+		}
+		break;
+	case 2:
+		for (size_t i = 0; i < size; ++i) {
+			row[i] += prev[i];
+		}
+		break;
+	case 3:
+		for (size_t i = 0; i < size; ++i) {
+			row[i] += ((i >= (size_t)bpp ? row[i - bpp] : 0) + prev[i]) >> 1;
+		}
+		break;
+	case 4:
+		for (size_t i = 0; i < size; ++i) {
+			int a = i >= (size_t)bpp ? row[i - bpp] : 0, c = i >= (size_t)bpp ? prev[i - bpp] : 0;
+			row[i] += (unsigned char)Paeth(a, prev[i], c);
+		}
+		break;
+	}
+}
+} // namespace
+
+std::vector<unsigned char> Png::encode(const unsigned char *data, int width, int height, int channels, int level) {
+	if (width <= 0 || height <= 0 || channels < 1 || channels > 4) {
+		return {};
+	}
+	level = std::clamp(level, 0, 9);
+	const size_t stride = (size_t)width * channels;
+	const int rowsPerStrip = (int)std::clamp<size_t>(AYIN_PNG_STRIP_SIZE / (stride + 1), 1, height);
+	const int count = (height + rowsPerStrip - 1) / rowsPerStrip;
+
+	std::vector<Strip> strips(count);
+	ThreadPool::global().parallel_for(count, [&](int s) {
+		int y0 = s * rowsPerStrip, y1 = std::min(height, y0 + rowsPerStrip);
+		std::vector<unsigned char> filtered((stride + 1) * (y1 - y0));
+		std::vector<unsigned char> candidate(level > 1 ? stride + 1 : 0), zeros(stride, 0);
+		for (int y = y0; y < y1; ++y) {
+			const unsigned char *row = data + y * stride, *prev = y > 0 ? row - stride : zeros.data();
+			unsigned char *out = filtered.data() + (y - y0) * (stride + 1);
+			if (level <= 1) {
+				Filter(level == 0 ? 0 : 2, row, prev, stride, channels, out);
+				continue;
+			}
+			size_t best = SIZE_MAX;
+			for (int type = 0; type < 5; ++type) {
+				Filter(type, row, prev, stride, channels, candidate.data());
+				size_t cost = Cost(candidate.data() + 1, stride);
+				if (cost < best) {
+					best = cost;
+					std::copy(candidate.begin(), candidate.end(), out);
+				}
+			}
+		}
+
+		Strip &strip = strips[s];
+		strip.size = filtered.size();
+		strip.adler = Adler32(filtered.data(), filtered.size());
+		strip.chunk.reserve(filtered.size() / 2 + 64);
+		strip.chunk.resize(4);
+		const char *type = "IDAT";
+		strip.chunk.insert(strip.chunk.end(), type, type + 4);
+		if (s == 0) {
+			// zlib header: deflate with a 32 KiB window, and the level as a hint.
+			strip.chunk.push_back(0x78);
+			strip.chunk.push_back(level <= 1 ? 0x01 : level <= 6 ? 0x9c : 0xda);
+		}
+		Deflate(filtered.data(), filtered.size(), level, strip.chunk);
+		uint32_t length = (uint32_t)(strip.chunk.size() - 8);
+		for (int i = 0; i < 4; ++i) {
+			strip.chunk[i] = (unsigned char)(length >> (24 - 8 * i));
+		}
+		uint32_t crc = Crc32(0, strip.chunk.data() + 4, strip.chunk.size() - 4);
+		PutBigEndian(strip.chunk, crc);
+	});
+
+	std::vector<unsigned char> png = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+	std::vector<unsigned char> header;
+	PutBigEndian(header, (uint32_t)width);
+	PutBigEndian(header, (uint32_t)height);
+	const unsigned char colorTypes[4] = {0, 4, 2, 6};
+	header.insert(header.end(), {8, colorTypes[channels - 1], 0, 0, 0});
+	PutChunk(png, "IHDR", header.data(), header.size());
+
+	uint32_t adler = 1;
+	size_t size = png.size();
+	for (const Strip &strip : strips) {
+		adler = Adler32Combine(adler, strip.adler, strip.size);
+		size += strip.chunk.size();
+	}
+	png.reserve(size + 64);
+	for (Strip &strip : strips) {
+		png.insert(png.end(), strip.chunk.begin(), strip.chunk.end());
+		std::vector<unsigned char>().swap(strip.chunk);
+	}
+
+	// Final empty fixed Huffman block, then the checksum of all the filtered rows.
+	std::vector<unsigned char> tail = {0x03, 0x00};
+	PutBigEndian(tail, adler);
+	PutChunk(png, "IDAT", tail.data(), tail.size());
+	PutChunk(png, "IEND", nullptr, 0);
+	return png;
+}
+
+bool Png::write(const char *filename, const unsigned char *data, int width, int height, int channels, int level) {
+	std::vector<unsigned char> png = encode(data, width, height, channels, level);
+	if (png.empty()) {
+		return false;
+	}
+	FILE *file = fopen(filename, "wb");
+	if (file == nullptr) {
+		return false;
+	}
+	bool ok = fwrite(png.data(), 1, png.size(), file) == png.size();
+	return fclose(file) == 0 && ok;
+}
+
+bool Png::decode(std::FILE *file, Image &image, std::atomic<float> *progress) {
+	static const unsigned char signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+	unsigned char buffer[16];
+	if (fread(buffer, 1, 8, file) != 8 || memcmp(buffer, signature, 8) != 0) {
+		return false;
+	}
+	uint32_t length = 0;
+	char type[5] = {};
+	auto nextChunk = [&] {
+		if (fread(buffer, 1, 8, file) != 8) {
+			return false;
+		}
+		length = GetBigEndian(buffer);
+		memcpy(type, buffer + 4, 4);
+		return length <= 0x7fffffff;
+	};
+
+	// Chunks up to the first IDAT.
+	uint32_t width = 0, height = 0;
+	int depth = 0, colorType = -1;
+	unsigned char palette[256][4];
+	for (auto &entry : palette) {
+		entry[0] = entry[1] = entry[2] = 0;
+		entry[3] = 255;
+	}
+	int paletteSize = 0;
+	bool transparency = false;
+	uint16_t key[3] = {};
+	for (;;) {
+		if (!nextChunk()) {
+			return false;
+		}
+		if (strcmp(type, "IDAT") == 0) {
+			break;
+		}
+		if (strcmp(type, "IEND") == 0) {
+			return false;
+		}
+		if (strcmp(type, "IHDR") != 0 && strcmp(type, "PLTE") != 0 && strcmp(type, "tRNS") != 0) {
+			if (fseek(file, (long)length + 4, SEEK_CUR) != 0) {
+				return false;
+			}
+			continue;
+		}
+		std::vector<unsigned char> data(length);
+		if (length > 1024 || fread(data.data(), 1, length, file) != length || fseek(file, 4, SEEK_CUR) != 0) {
+			return false;
+		}
+		if (strcmp(type, "IHDR") == 0) {
+			// Interlaced images (the last byte) are left to stb_image.
+			if (length != 13 || data[10] != 0 || data[11] != 0 || data[12] != 0) {
+				return false;
+			}
+			width = GetBigEndian(&data[0]);
+			height = GetBigEndian(&data[4]);
+			depth = data[8];
+			colorType = data[9];
+		} else if (strcmp(type, "PLTE") == 0) {
+			if (length % 3 != 0 || length > 768) {
+				return false;
+			}
+			paletteSize = (int)length / 3;
+			for (int i = 0; i < paletteSize; ++i) {
+				memcpy(palette[i], &data[3 * i], 3);
+			}
+		} else if (strcmp(type, "tRNS") == 0) {
+			transparency = true;
+			if (colorType == 3 && (int)length <= paletteSize) {
+				for (uint32_t i = 0; i < length; ++i) {
+					palette[i][3] = data[i];
+				}
+			} else if ((colorType == 0 && length == 2) || (colorType == 2 && length == 6)) {
+				for (uint32_t i = 0; i < length / 2; ++i) {
+					key[i] = (uint16_t)(data[2 * i] << 8 | data[2 * i + 1]);
+				}
+			} else {
+				return false;
+			}
+		}
+	}
+
+	static const int samplesOf[7] = {1, 0, 3, 1, 2, 0, 4};
+	if (width == 0 || height == 0 || width > INT32_MAX || height > INT32_MAX || colorType < 0 || colorType > 6 ||
+		samplesOf[colorType] == 0 || !(depth == 8 || (depth == 16 && colorType != 3)) ||
+		(colorType == 3 && paletteSize == 0)) {
+		return false;
+	}
+	const int samples = samplesOf[colorType], bpp = samples * depth / 8;
+	const bool colorKey = transparency && (colorType == 0 || colorType == 2);
+	const int channels = colorType == 3 ? (transparency ? 4 : 3) : samples + (colorKey ? 1 : 0);
+	const size_t rowSize = (size_t)width * bpp;
+	if (!image.allocate((int)width, (int)height, channels)) {
+		return false;
+	}
+
+	uint32_t remaining = length;
+	bool end = false;
+	auto read = [&](unsigned char *dst, size_t size) -> size_t {
+		while (remaining == 0) {
+			if (end || fseek(file, 4, SEEK_CUR) != 0 || !nextChunk() || strcmp(type, "IDAT") != 0) {
+				end = true;
+				return 0;
+			}
+			remaining = length;
+		}
+		size_t n = fread(dst, 1, std::min<size_t>(size, remaining), file);
+		remaining -= (uint32_t)n;
+		end = end || n == 0;
+		return n;
+	};
+
+	std::vector<unsigned char> row(rowSize), prev(rowSize, 0);
+	size_t filled = 0;
+	int filter = 0;
+	uint32_t y = 0;
+	auto write = [&](const unsigned char *src, size_t size) {
+		while (size > 0 && y < height) {
+			if (filled == 0) {
+				filter = *src++;
+				--size;
+				filled = 1;
+				if (filter > 4) {
+					return false;
+				}
+				continue;
+			}
+			size_t n = std::min(size, rowSize + 1 - filled);
+			memcpy(row.data() + filled - 1, src, n);
+			filled += n;
+			src += n;
+			size -= n;
+			if (filled < rowSize + 1) {
+				continue;
+			}
+			Unfilter(filter, row.data(), prev.data(), rowSize, bpp);
+			unsigned char *dst = image.data + (size_t)y * width * channels;
+			if (colorType == 3) {
+				for (uint32_t x = 0; x < width; ++x) {
+					memcpy(dst + x * channels, palette[row[x]], channels);
+				}
+			} else if (depth == 8 && !colorKey) {
+				memcpy(dst, row.data(), rowSize);
+			} else {
+				const int step = depth / 8;
+				for (uint32_t x = 0; x < width; ++x) {
+					const unsigned char *pixel = row.data() + (size_t)x * bpp;
+					bool keyed = colorKey;
+					for (int s = 0; s < samples; ++s) {
+						int value = step == 2 ? pixel[2 * s] << 8 | pixel[2 * s + 1] : pixel[s];
+						keyed = keyed && value == (step == 2 ? key[s] : (key[s] & 0xff));
+						dst[(size_t)x * channels + s] = pixel[s * step];
+					}
+					if (colorKey) {
+						dst[(size_t)x * channels + samples] = keyed ? 0 : 255;
+					}
+				}
+			}
+			std::swap(row, prev);
+			filled = 0;
+			++y;
+			if (progress != nullptr && (y % 64 == 0 || y == height)) {
+				progress->store((float)y / height, std::memory_order_relaxed);
+			}
+		}
+		return true;
+	};
+
+	return Inflater(read, write).run() && y == height;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "Image.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdio>
+#include <vector>
+
+#ifndef AYIN_PNG_LEVEL
+// Default compression level of saved PNGs: 0 stores the pixels uncompressed, 1 is the fast mode (one filter for all
+// rows and a single match probe), 2 to 9 pick the best filter per row and search ever longer match chains.
+#define AYIN_PNG_LEVEL 6
+#endif
+
+#ifndef AYIN_PNG_STRIP_SIZE
+// Bytes of filtered rows compressed as one independent piece of the zlib stream. Every strip starts with an empty
+// match window, so smaller strips spread over more threads but compress slightly worse.
+#define AYIN_PNG_STRIP_SIZE ((size_t)1024 * 1024)
+#endif
+
+// PNG encoder that filters and deflates strips of rows in parallel on the thread pool. Each strip is deflated on its
+// own and ends with an empty stored block, which byte-aligns it, so the strips concatenate into one zlib stream that
+// any inflater reads; their Adler-32 checksums are combined at the end. Deflate uses the fixed Huffman codes, like
+// stb_image_write.
+//
+// The decoder streams: it inflates the IDAT chunks as it reads them and unfilters each row into the image as soon as
+// it is complete, keeping only the deflate window and two rows besides the image.
+namespace ayin::Png {
+// Returns the PNG file for 8-bit pixels with 1 (gray), 2 (gray and alpha), 3 (RGB) or 4 (RGBA) channels.
+std::vector<unsigned char> encode(const unsigned char *data, int width, int height, int channels,
+								  int level = AYIN_PNG_LEVEL);
+bool write(const char *filename, const unsigned char *data, int width, int height, int channels,
+		   int level = AYIN_PNG_LEVEL);
+// Decodes file, from its start, into image with 8 bits per sample, like stb_image: 16-bit samples keep their high
+// byte, palettes are expanded, and a tRNS chunk adds an alpha channel. Returns false for malformed files and for
+// interlaced or sub-byte ones, which it does not handle. progress, if given, goes from 0 to 1 meanwhile.
+bool decode(std::FILE *file, Image &image, std::atomic<float> *progress = nullptr);
+} // namespace ayin::Png
@@ -0,0 +1,168 @@
+#include "Pnm.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+using namespace ayin;
+
+#ifndef AYIN_PNM_STRIP_SIZE
+// Bytes read into the image per fread() call when no conversion is needed.
+#define AYIN_PNM_STRIP_SIZE ((size_t)4 * 1024 * 1024)
+#endif
+
+namespace {
+struct Header {
+	int width = 0;
+	int height = 0;
+	int channels = 0;
+	int maxval = 0;
+};
+
+// Next whitespace-separated token, skipping comments. Consumes the single whitespace character after it.
+bool Token(std::FILE *file, std::string &token) {
+	token.clear();
+	int c = getc(file);
+	for (;;) {
+		while (c != EOF && isspace(c)) {
+			c = getc(file);
+		}
+		if (c != '#') {
+			break;
+		}
+		while (c != EOF && c != '\n') {
+			c = getc(file);
+		}
+	}
+	while (c != EOF && !isspace(c) && token.size() < 64) {
+		token += (char)c;
+		c = getc(file);
+	}
+	return !token.empty();
+}
+
+bool Number(std::FILE *file, int &value) {
+	std::string token;
+	auto digit = [](char c) { return isdigit((unsigned char)c) != 0; };
+	if (!Token(file, token) || token.size() > 9 || !std::all_of(token.begin(), token.end(), digit)) {
+		return false;
+	}
+	value = std::stoi(token);
+	return true;
+}
+
+bool ReadHeader(std::FILE *file, Header &header) {
+	char magic[2];
+	if (fread(magic, 1, 2, file) != 2 || magic[0] != 'P' || magic[1] < '5' || magic[1] > '7') {
+		return false;
+	}
+	if (magic[1] == '7') {
+		// PAM: KEY value lines up to ENDHDR. TUPLTYPE is implied by DEPTH.
+		std::string key;
+		int depth = 0;
+		while (Token(file, key) && key != "ENDHDR") {
+			if (key == "WIDTH") {
+				Number(file, header.width);
+			} else if (key == "HEIGHT") {
+				Number(file, header.height);
+			} else if (key == "DEPTH") {
+				Number(file, depth);
+			} else if (key == "MAXVAL") {
+				Number(file, header.maxval);
+			}
+		}
+		if (key != "ENDHDR") {
+			return false;
+		}
+		header.channels = depth;
+	} else {
+		header.channels = magic[1] == '5' ? 1 : 3;
+		if (!Number(file, header.width) || !Number(file, header.height) || !Number(file, header.maxval)) {
+			return false;
+		}
+	}
+	return header.width > 0 && header.height > 0 && header.channels >= 1 && header.channels <= 4 &&
+		   header.maxval >= 1 && header.maxval <= 65535;
+}
+} // namespace
+
+bool Pnm::info(const char *filename, int &width, int &height, int &channels) {
+	std::FILE *file = fopen(filename, "rb");
+	if (file == nullptr) {
+		return false;
+	}
+	Header header;
+	bool ok = ReadHeader(file, header);
+	fclose(file);
+	if (ok) {
+		width = header.width;
+		height = header.height;
+		channels = header.channels;
+	}
+	return ok;
+}
+
+bool Pnm::decode(std::FILE *file, Image &image, std::atomic<float> *progress) {
+	Header header;
+	if (!ReadHeader(file, header) || !image.allocate(header.width, header.height, header.channels)) {
+		return false;
+	}
+	const size_t stride = (size_t)header.width * header.channels;
+
+	if (header.maxval == 255) {
+		// The file holds the pixels exactly as the image does: read them in place.
+		const int rowsPerStrip = (int)std::clamp<size_t>(AYIN_PNM_STRIP_SIZE / stride, 1, header.height);
+		for (int y = 0; y < header.height; y += rowsPerStrip) {
+			size_t size = std::min(rowsPerStrip, header.height - y) * stride;
+			if (fread(image.data + y * stride, 1, size, file) != size) {
+				return false;
+			}
+			if (progress != nullptr) {
+				float done = std::min(1.0f, (float)(y + rowsPerStrip) / header.height);
+				progress->store(done, std::memory_order_relaxed);
+			}
+		}
+		return true;
+	}
+
+	const int sampleSize = header.maxval > 255 ? 2 : 1;
+	const unsigned int maxval = header.maxval;
+	std::vector<unsigned char> row(stride * sampleSize);
+	for (int y = 0; y < header.height; ++y) {
+		if (fread(row.data(), 1, row.size(), file) != row.size()) {
+			return false;
+		}
+		unsigned char *dst = image.data + y * stride;
+		for (size_t i = 0; i < stride; ++i) {
+			unsigned int value = sampleSize == 2 ? row[2 * i] << 8 | row[2 * i + 1] : row[i];
+			dst[i] = (unsigned char)((std::min(value, maxval) * 255 + maxval / 2) / maxval);
+		}
+		if (progress != nullptr && y % 64 == 0) {
+			progress->store((float)y / header.height, std::memory_order_relaxed);
+		}
+	}
+	return true;
+}
+
+bool Pnm::write(const char *filename, const unsigned char *data, int width, int height, int channels, bool pam) {
+	if (width <= 0 || height <= 0 || channels < 1 || channels > 4) {
+		return false;
+	}
+	std::FILE *file = fopen(filename, "wb");
+	if (file == nullptr) {
+		return false;
+	}
+	if (pam || channels == 2 || channels == 4) {
+		static const char *const TupleTypes[] = {"GRAYSCALE", "GRAYSCALE_ALPHA", "RGB", "RGB_ALPHA"};
+		fprintf(file, "P7\nWIDTH %d\nHEIGHT %d\nDEPTH %d\nMAXVAL 255\nTUPLTYPE %s\nENDHDR\n", width, height, channels,
+				TupleTypes[channels - 1]);
+	} else {
+		fprintf(file, "P%c\n%d %d\n255\n", channels == 1 ? '5' : '6', width, height);
+	}
+	const size_t size = (size_t)width * height * channels;
+	bool ok = fwrite(data, 1, size, file) == size;
+	return fclose(file) == 0 && ok;
+}
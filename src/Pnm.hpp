@@ -0,0 +1,18 @@
+#pragma once
+
+#include "Image.hpp"
+
+#include <atomic>
+#include <cstdio>
+
+// Binary Netpbm images: PGM (P5), PPM (P6) and PAM (P7) with 1 to 4 channels. They are decoded row by row straight
+// from the file into the image, with samples of more than 8 bits, or a maximum value other than 255, scaled to 8 bits.
+// Written files always have 8-bit samples, so the pixels go to the file as they are.
+namespace ayin::Pnm {
+// Reads only the header. Returns false if the file is not a binary PGM, PPM or PAM.
+bool info(const char *filename, int &width, int &height, int &channels);
+// Decodes file, from its start, into image. progress, if given, goes from 0 to 1 meanwhile.
+bool decode(std::FILE *file, Image &image, std::atomic<float> *progress = nullptr);
+// Writes a PGM or PPM for 1 or 3 channels, unless pam is set, and a PAM otherwise, since only PAM stores alpha.
+bool write(const char *filename, const unsigned char *data, int width, int height, int channels, bool pam = false);
+} // namespace ayin::Pnm
@@ -0,0 +1,460 @@
+#include "Project.hpp"
+#include "MappedFile.hpp"
+#include "Rle.hpp"
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <system_error>
+
+using namespace ayin;
+
+// The header and tables are stored in the byte order of the machine that wrote them, which is little-endian on every
+// platform Ayin builds for.
+namespace {
+const char Magic[8] = {'A', 'Y', 'I', 'N', 'P', 'R', 'J', '\0'};
+const uint32_t Version = 1;
+const uint64_t PageSize = 4096;
+const uint32_t NoReference = UINT32_MAX;
+
+enum Encoding : uint32_t {
+	Encoding_Raw,
+	Encoding_Rle,
+	// Rle of the XOR against the same tile of the reference image.
+	Encoding_RleDelta,
+};
+
+struct Header {
+	char magic[8];
+	uint32_t version;
+	uint32_t tileRows;
+	// Images are the current one, the original, then the Merge images.
+	uint32_t imageCount;
+	uint32_t stepCount;
+	uint32_t undoPosition;
+	uint32_t reserved;
+};
+
+struct ImageEntry {
+	int32_t width, height, channels;
+	// Image the Encoding_RleDelta tiles are against, or NoReference.
+	uint32_t reference;
+	// Offset of the image's TileEntry table.
+	uint64_t tiles;
+};
+
+struct StepEntry {
+	uint32_t type;
+	// The command's parameters; for Merge, the index of its image among the Merge images, or -1.
+	int32_t params[4];
+};
+
+struct TileEntry {
+	uint64_t offset;
+	uint64_t size;
+	uint32_t encoding;
+	uint32_t reserved;
+};
+
+uint64_t RoundUp(uint64_t offset) { return (offset + PageSize - 1) / PageSize * PageSize; }
+
+size_t TileCount(int height, int tileRows) { return (size_t)((height + tileRows - 1) / tileRows); }
+
+void GetParams(const Commands::Info &info, int32_t params[4]) {
+	switch (info.ty) {
+	case Commands::Type_Crop:
+		params[0] = info.crop_x;
+		params[1] = info.crop_y;
+		params[2] = info.crop_width;
+		params[3] = info.crop_height;
+		break;
+	case Commands::Type_Frame:
+		params[0] = info.frame_fanciness;
+		params[1] = (int32_t)info.frame_color;
+		break;
+	case Commands::Type_Resize:
+		params[0] = info.resize_width;
+		params[1] = info.resize_height;
+		break;
+	case Commands::Type_DarkenAndLighten:
+	case Commands::Type_Glasses3D:
+		params[0] = info.darkenlighten_factor;
+		break;
+	case Commands::Type_Blur:
+	case Commands::Type_MotionBlur:
+		params[0] = info.blur_level;
+		break;
+	case Commands::Type_Skew:
+		params[0] = info.skew_angle;
+		break;
+	case Commands::Type_Rotate:
+		params[0] = info.rotate_turns;
+		break;
+	default:
+		break;
+	}
+}
+
+Commands::Info MakeInfo(Commands::Type type, const int32_t params[4]) {
+	switch (type) {
+	case Commands::Type_Crop:
+		return Commands::Info(type, params[0], params[1], params[2], params[3]);
+	case Commands::Type_Frame:
+		return Commands::Info(type, params[0], (unsigned int)params[1]);
+	case Commands::Type_Resize:
+		return Commands::Info(type, params[0], params[1]);
+	case Commands::Type_DarkenAndLighten:
+	case Commands::Type_Glasses3D:
+	case Commands::Type_Blur:
+	case Commands::Type_MotionBlur:
+	case Commands::Type_Skew:
+	case Commands::Type_Rotate:
+		return Commands::Info(type, params[0]);
+	default:
+		return Commands::Info(type);
+	}
+}
+
+// A tile to encode on save.
+struct Tile {
+	const Image *image;
+	const Image *reference;
+	int y;
+	int rows;
+	std::vector<unsigned char> encoded{};
+	uint32_t encoding = Encoding_Raw;
+
+	const unsigned char *raw() const { return image->data + (size_t)y * image->width * image->channels; }
+	size_t raw_size() const { return (size_t)rows * image->width * image->channels; }
+	const unsigned char *data() const { return encoding == Encoding_Raw ? raw() : encoded.data(); }
+	size_t size() const { return encoding == Encoding_Raw ? raw_size() : encoded.size(); }
+
+	void encode() {
+		if (!AYIN_PROJECT_COMPRESS) {
+			return;
+		}
+		if (reference != nullptr) {
+			std::vector<unsigned char> delta(raw_size());
+			const unsigned char *a = raw(), *b = reference->data + (raw() - image->data);
+			for (size_t i = 0; i < delta.size(); ++i) {
+				delta[i] = a[i] ^ b[i];
+			}
+			encoded = Rle::compress(delta.data(), delta.size());
+			encoding = Encoding_RleDelta;
+		} else {
+			encoded = Rle::compress(raw(), raw_size());
+			encoding = Encoding_Rle;
+		}
+		if (encoded.size() >= raw_size()) {
+			encoded = {};
+			encoding = Encoding_Raw;
+		}
+	}
+};
+} // namespace
+
+bool Project::is_project(const std::string &filename) {
+	const size_t n = sizeof(AYIN_PROJECT_EXTENSION) - 1;
+	return filename.size() > n && filename.compare(filename.size() - n, n, AYIN_PROJECT_EXTENSION) == 0;
+}
+
+// True if the tiles of entry are all raw and follow each other without gaps, so the image's rows lie in the file
+// exactly as in memory.
+static bool Contiguous(const ImageEntry &entry, const std::vector<TileEntry> &tiles, int tileRows) {
+	size_t stride = (size_t)entry.width * entry.channels;
+	for (size_t t = 0; t < tiles.size(); ++t) {
+		size_t rows = std::min<size_t>(tileRows, entry.height - t * tileRows);
+		if (tiles[t].encoding != Encoding_Raw || tiles[t].size != rows * stride ||
+			tiles[t].offset != tiles[0].offset + t * tileRows * stride) {
+			return false;
+		}
+	}
+	return !tiles.empty();
+}
+
+static bool ReadHeader(const MappedFile &file, Header &header, ImageEntry &first) {
+	if (file.size() < sizeof(Header) + sizeof(ImageEntry)) {
+		return false;
+	}
+	memcpy(&header, file.data(), sizeof(Header));
+	memcpy(&first, file.data() + sizeof(Header), sizeof(ImageEntry));
+	return memcmp(header.magic, Magic, sizeof(Magic)) == 0 && header.version == Version && header.tileRows > 0 &&
+		   header.tileRows <= (1u << 20) &&
+		   header.imageCount >= 2;
+}
+
+bool Project::info(const char *filename, int &width, int &height, int &channels) {
+	MappedFile file;
+	Header header;
+	ImageEntry first;
+	if (!file.open(filename) || !ReadHeader(file, header, first)) {
+		return false;
+	}
+	width = first.width;
+	height = first.height;
+	channels = first.channels;
+	return true;
+}
+
+bool Project::load(const char *filename, Contents &contents, const std::function<void(Contents &)> &imageLoaded) {
+	MappedFile file;
+	Header header;
+	ImageEntry first;
+	if (!file.open(filename) || !ReadHeader(file, header, first) ||
+		header.imageCount > (uint64_t)header.stepCount + 2 || header.undoPosition > header.stepCount) {
+		return false;
+	}
+	// The counts are checked against what the file can hold before anything is sized by them.
+	uint64_t tables = sizeof(Header) + (uint64_t)header.imageCount * sizeof(ImageEntry) +
+					  (uint64_t)header.stepCount * sizeof(StepEntry);
+	if (tables > file.size()) {
+		return false;
+	}
+	auto read = [&](uint64_t offset, void *dst, size_t size) {
+		if (offset > file.size() || size > file.size() - offset) {
+			return false;
+		}
+		if (size != 0) {
+			memcpy(dst, file.data() + offset, size);
+		}
+		return true;
+	};
+
+	const int tileRows = (int)header.tileRows;
+	uint64_t offset = sizeof(Header);
+	std::vector<ImageEntry> entries(header.imageCount);
+	std::vector<StepEntry> steps(header.stepCount);
+	if (!read(offset, entries.data(), entries.size() * sizeof(ImageEntry)) ||
+		!read(offset + entries.size() * sizeof(ImageEntry), steps.data(), steps.size() * sizeof(StepEntry))) {
+		return false;
+	}
+
+	std::vector<std::unique_ptr<Image>> images;
+	std::vector<std::vector<TileEntry>> tiles(entries.size());
+	// Whether the current image is mapped from the file rather than decoded.
+	bool mapped = false;
+	for (size_t i = 0; i < entries.size(); ++i) {
+		const ImageEntry &entry = entries[i];
+		// Two bytes of Rle expand to at most 130, which bounds what a file of this size can hold.
+		if (entry.width <= 0 || entry.height <= 0 || entry.channels < 1 || entry.channels > 4 ||
+			(uint64_t)entry.width * entry.height * entry.channels > (uint64_t)file.size() * 65) {
+			return false;
+		}
+		if (entry.reference != NoReference) {
+			const ImageEntry *reference = entry.reference < i ? &entries[entry.reference] : nullptr;
+			if (reference == nullptr || reference->reference != NoReference || reference->width != entry.width ||
+				reference->height != entry.height || reference->channels != entry.channels) {
+				return false;
+			}
+		}
+		size_t tileCount = TileCount(entry.height, tileRows);
+		if (tileCount > file.size() / sizeof(TileEntry)) {
+			return false;
+		}
+		tiles[i].resize(tileCount);
+		if (!read(entry.tiles, tiles[i].data(), tiles[i].size() * sizeof(TileEntry))) {
+			return false;
+		}
+		for (const TileEntry &tile : tiles[i]) {
+			if (tile.offset > file.size() || tile.size > file.size() - tile.offset ||
+				tile.encoding > Encoding_RleDelta ||
+				(tile.encoding == Encoding_RleDelta && entry.reference == NoReference)) {
+				return false;
+			}
+		}
+		if (i == 0 && Contiguous(entry, tiles[0], tileRows)) {
+			size_t size = (size_t)entry.width * entry.height * entry.channels;
+			if (unsigned char *data = MappedFile::map_copy(filename, tiles[0][0].offset, size)) {
+				images.push_back(std::make_unique<Image>());
+				images.back()->width = entry.width;
+				images.back()->height = entry.height;
+				images.back()->channels = entry.channels;
+				images.back()->data = data;
+				mapped = true;
+				continue;
+			}
+		}
+		images.push_back(std::make_unique<Image>(entry.width, entry.height, entry.channels));
+		if (images.back()->data == nullptr) {
+			return false;
+		}
+	}
+
+	contents.steps.clear();
+	for (const StepEntry &step : steps) {
+		if (step.type >= (uint32_t)Commands::number) {
+			return false;
+		}
+		Commands::Type type = (Commands::Type)step.type;
+		if (type == Commands::Type_Merge) {
+			int32_t index = step.params[0];
+			if (index < -1 || index >= (int32_t)images.size() - 2) {
+				return false;
+			}
+			contents.steps.emplace_back(type, index < 0 ? nullptr : images[index + 2].get());
+		} else {
+			contents.steps.push_back(MakeInfo(type, step.params));
+		}
+	}
+	contents.undo_position = (int)header.undoPosition;
+
+	// A mapped current image can be shown right away; deltas against it read its rows from the file instead.
+	const unsigned char *mappedRows = mapped ? file.data() + tiles[0][0].offset : nullptr;
+	if (mapped && imageLoaded) {
+		contents.image = std::move(images[0]);
+		imageLoaded(contents);
+	}
+
+	// Tiles of images that others are deltas against first, then the deltas.
+	std::atomic<bool> ok = true;
+	for (bool deltas : {false, true}) {
+		std::vector<std::pair<size_t, size_t>> jobs;
+		for (size_t i = mapped ? 1 : 0; i < entries.size(); ++i) {
+			if ((entries[i].reference != NoReference) == deltas) {
+				for (size_t t = 0; t < tiles[i].size(); ++t) {
+					jobs.emplace_back(i, t);
+				}
+			}
+		}
+		ThreadPool::global().parallel_for((int)jobs.size(), [&](int job) {
+			auto [i, t] = jobs[job];
+			Image &image = *images[i];
+			const TileEntry &tile = tiles[i][t];
+			size_t stride = (size_t)image.width * image.channels;
+			size_t y = t * tileRows, rows = std::min<size_t>(tileRows, image.height - y);
+			unsigned char *dst = image.data + y * stride;
+			const unsigned char *src = file.data() + tile.offset;
+			bool tileOk = false;
+			if (tile.encoding == Encoding_Raw) {
+				tileOk = tile.size == rows * stride;
+				if (tileOk) {
+					memcpy(dst, src, rows * stride);
+				}
+			} else if (tile.encoding == Encoding_Rle) {
+				tileOk = Rle::decompress(src, tile.size, dst, rows * stride);
+			} else {
+				uint32_t reference = entries[i].reference;
+				const unsigned char *base = reference == 0 && mapped ? mappedRows : images[reference]->data;
+				memcpy(dst, base + y * stride, rows * stride);
+				tileOk = Rle::decompress_xor(src, tile.size, dst, rows * stride);
+			}
+			if (!tileOk) {
+				ok = false;
+			}
+		});
+	}
+	if (!ok) {
+		return false;
+	}
+
+	if (images[0] != nullptr) {
+		contents.image = std::move(images[0]);
+		if (imageLoaded) {
+			imageLoaded(contents);
+		}
+	}
+	contents.original = std::move(images[1]);
+	contents.assets.clear();
+	for (size_t i = 2; i < images.size(); ++i) {
+		contents.assets.push_back(std::move(images[i]));
+	}
+	return true;
+}
+
+bool Project::save(const char *filename, const Image &image, const Image &original,
+				   const std::vector<Commands::Info> &steps, int undoPosition) {
+	std::vector<const Image *> images = {&image, &original};
+	std::vector<StepEntry> stepEntries;
+	for (const Commands::Info &info : steps) {
+		StepEntry entry{(uint32_t)info.ty, {0, 0, 0, 0}};
+		if (info.ty == Commands::Type_Merge) {
+			entry.params[0] = -1;
+			if (info.merge_image != nullptr) {
+				auto it = std::find(images.begin() + 2, images.end(), info.merge_image);
+				entry.params[0] = (int32_t)(it - images.begin()) - 2;
+				if (it == images.end()) {
+					images.push_back(info.merge_image);
+				}
+			}
+		} else {
+			GetParams(info, entry.params);
+		}
+		stepEntries.push_back(entry);
+	}
+
+	const int tileRows = AYIN_PROJECT_TILE_ROWS;
+	std::vector<ImageEntry> entries;
+	std::vector<Tile> tiles;
+	std::vector<size_t> firstTile;
+	for (size_t i = 0; i < images.size(); ++i) {
+		const Image *img = images[i];
+		const Image *reference = nullptr;
+		if (i == 1 && AYIN_PROJECT_COMPRESS && original.width == image.width && original.height == image.height &&
+			original.channels == image.channels) {
+			reference = &image;
+		}
+		entries.push_back(ImageEntry{img->width, img->height, img->channels, reference ? 0 : NoReference, 0});
+		firstTile.push_back(tiles.size());
+		for (int y = 0; y < img->height; y += tileRows) {
+			tiles.push_back(Tile{img, reference, y, std::min(tileRows, img->height - y)});
+		}
+	}
+	// The current image stays raw, so loading can map it instead of decoding it.
+	ThreadPool::global().parallel_for((int)(tiles.size() - firstTile[1]),
+									  [&](int t) { tiles[firstTile[1] + t].encode(); });
+
+	uint64_t offset = sizeof(Header) + entries.size() * sizeof(ImageEntry) + stepEntries.size() * sizeof(StepEntry);
+	for (size_t i = 0; i < entries.size(); ++i) {
+		entries[i].tiles = offset + firstTile[i] * sizeof(TileEntry);
+	}
+	std::vector<TileEntry> tileEntries;
+	offset = RoundUp(offset + tiles.size() * sizeof(TileEntry));
+	for (size_t t = 0; t < tiles.size(); ++t) {
+		tileEntries.push_back(TileEntry{offset, tiles[t].size(), tiles[t].encoding, 0});
+		// The current image's tiles follow each other without padding, as its rows do in memory.
+		offset = t + 1 < firstTile[1] ? offset + tiles[t].size() : RoundUp(offset + tiles[t].size());
+	}
+
+	Header header{};
+	memcpy(header.magic, Magic, sizeof(Magic));
+	header.version = Version;
+	header.tileRows = tileRows;
+	header.imageCount = (uint32_t)entries.size();
+	header.stepCount = (uint32_t)stepEntries.size();
+	header.undoPosition = (uint32_t)std::clamp(undoPosition, 0, (int)stepEntries.size());
+
+	// Written next to the target and renamed over it once complete, so a failed save leaves the old file intact.
+	static std::atomic<unsigned int> counter{0};
+	std::string temporary = std::string(filename) + "." + std::to_string(counter++) + ".tmp";
+	FILE *file = fopen(temporary.c_str(), "wb");
+	if (file == nullptr) {
+		return false;
+	}
+	static const unsigned char zeros[PageSize] = {};
+	uint64_t written = 0;
+	auto write = [&](const void *data, size_t size) {
+		written += size;
+		return size == 0 || fwrite(data, 1, size, file) == size;
+	};
+	bool ok = write(&header, sizeof(header)) && write(entries.data(), entries.size() * sizeof(ImageEntry)) &&
+			  write(stepEntries.data(), stepEntries.size() * sizeof(StepEntry)) &&
+			  write(tileEntries.data(), tileEntries.size() * sizeof(TileEntry));
+	for (size_t t = 0; ok && t < tiles.size(); ++t) {
+		ok = write(zeros, tileEntries[t].offset - written) && write(tiles[t].data(), tiles[t].size());
+	}
+	ok = fclose(file) == 0 && ok;
+	std::error_code ec;
+	if (ok) {
+		std::filesystem::rename(std::filesystem::u8path(temporary), std::filesystem::u8path(filename), ec);
+	}
+	if (!ok || ec) {
+		std::filesystem::remove(std::filesystem::u8path(temporary), ec);
+		return false;
+	}
+	return true;
+}
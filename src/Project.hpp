@@ -0,0 +1,56 @@
+#pragma once
+
+#include "Commands.hpp"
+#include "Image.hpp"
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+#ifndef AYIN_PROJECT_EXTENSION
+#define AYIN_PROJECT_EXTENSION ".ayin"
+#endif
+
+#ifndef AYIN_PROJECT_TILE_ROWS
+#define AYIN_PROJECT_TILE_ROWS 64
+#endif
+
+#ifndef AYIN_PROJECT_COMPRESS
+// Run-length code the tiles of the original and Merge images (keeping the ones that do not shrink raw), and store the
+// original as a delta against the current image. Off, every tile is written raw, which saves fastest. The current
+// image is always raw.
+#define AYIN_PROJECT_COMPRESS 1
+#endif
+
+// Project files (.ayin) keep a photo as it is being edited: the current image, the original, the Merge images the
+// history refers to, and the history itself, so reopening one needs no image decoder and keeps undo.
+//
+// The file starts with a header and tables of images, steps and tiles, followed by the pixels in tiles of
+// AYIN_PROJECT_TILE_ROWS rows. A tile is raw, run-length coded (Rle), or run-length coded as the XOR against the same
+// tile of another image of the file. The current image is stored as raw tiles without gaps from a page boundary on,
+// which are its rows exactly as they lie in memory: loading maps them copy-on-write as the image's pixels, so the
+// image can be shown before anything is decoded and its pages are only read as they are used. The tiles of the other
+// images each start on a page boundary; loading decodes them in parallel, and saving encodes them in parallel.
+// Saving writes a temporary file next to the target and renames it over the target once it is complete.
+namespace ayin::Project {
+struct Contents {
+	std::unique_ptr<Image> image{};
+	std::unique_ptr<Image> original{};
+	// Images of Merge steps, which point into this list.
+	std::vector<std::unique_ptr<Image>> assets{};
+	std::vector<Commands::Info> steps{};
+	// Number of steps at the end that are undone.
+	int undo_position = 0;
+};
+
+// True if filename has the project extension.
+bool is_project(const std::string &filename);
+// Reads only the header: the dimensions of the current image.
+bool info(const char *filename, int &width, int &height, int &channels);
+// Loads a project file. imageLoaded, if given, is called with contents.image set as soon as the current image is
+// available, which for a mapped image is before the other images are decoded; it may take contents.image. If loading
+// fails after that, load() still returns false.
+bool load(const char *filename, Contents &contents, const std::function<void(Contents &)> &imageLoaded = nullptr);
+bool save(const char *filename, const Image &image, const Image &original, const std::vector<Commands::Info> &steps,
+		  int undoPosition);
+} // namespace ayin::Project
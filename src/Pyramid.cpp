@@ -0,0 +1,114 @@
+#include "Pyramid.hpp"
+#include "ImageFilter.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace ayin;
+
+void Pyramid::rebuild(const Image &source) {
+	clear();
+	m_width = source.width;
+	m_height = source.height;
+	m_channels = source.channels;
+	m_textures.push_back(std::make_unique<TiledTexture>());
+	int width = source.width / 2, height = source.height / 2;
+	while (width >= AYIN_PYRAMID_MIN_SIZE && height >= AYIN_PYRAMID_MIN_SIZE) {
+		m_levels.push_back(std::make_unique<Image>(width, height, source.channels));
+		m_dirty.push_back(Rect{0, 0, width, height});
+		m_textures.push_back(std::make_unique<TiledTexture>());
+		width /= 2;
+		height /= 2;
+	}
+}
+
+void Pyramid::invalidate() {
+	for (size_t i = 0; i < m_levels.size(); ++i) {
+		m_dirty[i] = Rect{0, 0, m_levels[i]->width, m_levels[i]->height};
+	}
+	for (auto &texture : m_textures) {
+		texture->invalidate();
+	}
+}
+
+void Pyramid::invalidate(Rect rect) {
+	if (rect.empty()) {
+		return;
+	}
+	if (!m_textures.empty()) {
+		m_textures[0]->invalidate(rect);
+	}
+	for (size_t i = 0; i < m_levels.size(); ++i) {
+		int shift = (int)i + 1;
+		int x0 = rect.x >> shift, y0 = rect.y >> shift;
+		int x1 = ((rect.x + rect.width - 1) >> shift) + 1, y1 = ((rect.y + rect.height - 1) >> shift) + 1;
+		Rect level = Rect{x0, y0, x1 - x0, y1 - y0}.intersect(Rect{0, 0, m_levels[i]->width, m_levels[i]->height});
+		m_dirty[i] = m_dirty[i].unite(level);
+	}
+}
+
+const Image &Pyramid::level(const Image &source, int n) {
+	if (source.width != m_width || source.height != m_height || source.channels != m_channels) {
+		rebuild(source);
+	}
+	n = std::min(n, (int)m_levels.size());
+	if (n <= 0) {
+		return source;
+	}
+	for (int i = 0; i < n; ++i) {
+		if (!m_dirty[i].empty()) {
+			ImageFilter::Reduce(i == 0 ? source : *m_levels[i - 1], *m_levels[i], m_dirty[i]);
+			m_textures[i + 1]->invalidate(m_dirty[i]);
+			m_dirty[i] = Rect{};
+		}
+	}
+	return *m_levels[n - 1];
+}
+
+void Pyramid::draw(const Image &source, int n, ImDrawList *drawList, ImVec2 pos, ImVec2 size, Rect visible) {
+	const Image &image = level(source, n);
+	n = std::clamp(n, 0, (int)m_levels.size());
+	// The visible part in level pixels, with a pixel of margin for partly covered ones.
+	int x0 = (visible.x >> n) - 1, y0 = (visible.y >> n) - 1;
+	int x1 = ((visible.x + visible.width - 1) >> n) + 2, y1 = ((visible.y + visible.height - 1) >> n) + 2;
+	Rect rect{x0, y0, x1 - x0, y1 - y0};
+	TiledTexture &texture = *m_textures[n];
+	texture.update(image, rect);
+	texture.draw(drawList, pos, ImVec2(size.x / image.width, size.y / image.height), rect);
+}
+
+int Pyramid::level_for_scale(float scale) {
+	if (scale >= 1.0f || scale <= 0.0f) {
+		return 0;
+	}
+	return (int)std::floor(std::log2(1.0f / scale));
+}
+
+size_t Pyramid::size() const {
+	size_t size = 0;
+	for (auto &level : m_levels) {
+		size += (size_t)level->width * level->height * level->channels;
+	}
+	return size;
+}
+
+size_t Pyramid::texture_size() const {
+	size_t size = 0;
+	for (auto &texture : m_textures) {
+		size += texture->size();
+	}
+	return size;
+}
+
+void Pyramid::unload_textures() {
+	for (auto &texture : m_textures) {
+		texture->unload();
+	}
+}
+
+void Pyramid::clear() {
+	m_width = m_height = m_channels = 0;
+	m_levels.clear();
+	m_dirty.clear();
+	m_textures.clear();
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "Image.hpp"
+#include "TiledTexture.hpp"
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+#include <imgui.h>
+
+#ifndef AYIN_PYRAMID_MIN_SIZE
+#define AYIN_PYRAMID_MIN_SIZE 32
+#endif
+
+namespace ayin {
+// Successively halved copies of an image, each made of 2x2 box averages of the level above it. Level 0 is the image
+// itself; levels stop once either side would drop below AYIN_PYRAMID_MIN_SIZE. Levels are built lazily and only the
+// invalidated parts are recomputed.
+class Pyramid {
+public:
+	Pyramid() = default;
+	Pyramid(const Pyramid &) = delete;
+	Pyramid &operator=(const Pyramid &) = delete;
+
+	void invalidate();
+	// Marks a region of the source image, in level 0 pixels, as changed.
+	void invalidate(Rect rect);
+
+	// Returns level n of source, bringing it and the levels above it up to date first. Level 0 returns source;
+	// levels past the smallest one return the smallest.
+	const Image &level(const Image &source, int n);
+	// Draws level n of source at pos, size being the on-screen size of the whole image. Only the texture tiles
+	// intersecting visible (in level 0 pixels) are drawn, and uploaded if they changed.
+	void draw(const Image &source, int n, ImDrawList *drawList, ImVec2 pos, ImVec2 size, Rect visible);
+	// Deepest level whose scale is still at least the given one.
+	static int level_for_scale(float scale);
+	size_t size() const;
+	// Bytes held by the levels' textures.
+	size_t texture_size() const;
+
+	void unload_textures();
+	// Frees all levels and textures; they are rebuilt when next needed.
+	void clear();
+
+private:
+	// Dimensions of the source the levels were built for.
+	int m_width = 0;
+	int m_height = 0;
+	int m_channels = 0;
+	std::vector<std::unique_ptr<Image>> m_levels{};
+	// Per level below 0: the part that is out of date.
+	std::vector<Rect> m_dirty{};
+	// Per level, starting with 0.
+	std::vector<std::unique_ptr<TiledTexture>> m_textures{};
+
+	void rebuild(const Image &source);
+};
+} // namespace ayin
@@ -0,0 +1,218 @@
+#include "Qoi.hpp"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+using namespace ayin;
+
+namespace {
+const unsigned char Magic[4] = {'q', 'o', 'i', 'f'};
+const size_t HeaderSize = 14;
+const unsigned char Padding[8] = {0, 0, 0, 0, 0, 0, 0, 1};
+// Largest image the format allows, so that the encoded size stays within reach of 32-bit readers.
+const uint64_t MaxPixels = 400000000;
+
+enum : unsigned char {
+	Op_Index = 0x00,
+	Op_Diff = 0x40,
+	Op_Luma = 0x80,
+	Op_Run = 0xc0,
+	Op_Rgb = 0xfe,
+	Op_Rgba = 0xff,
+	Op_Mask = 0xc0,
+};
+
+struct Pixel {
+	unsigned char r, g, b, a;
+
+	bool operator==(const Pixel &p) const { return r == p.r && g == p.g && b == p.b && a == p.a; }
+	bool operator!=(const Pixel &p) const { return !(*this == p); }
+	int hash() const { return (r * 3 + g * 5 + b * 7 + a * 11) % 64; }
+};
+
+uint32_t GetBigEndian(const unsigned char *p) {
+	return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+void PutBigEndian(unsigned char *p, uint32_t value) {
+	p[0] = (unsigned char)(value >> 24);
+	p[1] = (unsigned char)(value >> 16);
+	p[2] = (unsigned char)(value >> 8);
+	p[3] = (unsigned char)value;
+}
+
+bool ReadHeader(const unsigned char *data, size_t size, int &width, int &height, int &channels) {
+	if (!Qoi::is_qoi(data, size)) {
+		return false;
+	}
+	uint32_t w = GetBigEndian(data + 4), h = GetBigEndian(data + 8);
+	if (w == 0 || h == 0 || (uint64_t)w * h > MaxPixels || (data[12] != 3 && data[12] != 4)) {
+		return false;
+	}
+	width = (int)w;
+	height = (int)h;
+	channels = data[12];
+	return true;
+}
+} // namespace
+
+bool Qoi::is_qoi(const unsigned char *data, size_t size) {
+	return size >= HeaderSize && memcmp(data, Magic, sizeof(Magic)) == 0;
+}
+
+bool Qoi::info(const char *filename, int &width, int &height, int &channels) {
+	unsigned char header[HeaderSize];
+	std::FILE *file = fopen(filename, "rb");
+	if (file == nullptr) {
+		return false;
+	}
+	bool ok = fread(header, 1, HeaderSize, file) == HeaderSize;
+	fclose(file);
+	return ok && ReadHeader(header, HeaderSize, width, height, channels);
+}
+
+bool Qoi::decode(const unsigned char *data, size_t size, Image &image) {
+	int width, height, channels;
+	if (!ReadHeader(data, size, width, height, channels) || size < HeaderSize + sizeof(Padding) ||
+		!image.allocate(width, height, channels)) {
+		return false;
+	}
+	const unsigned char *p = data + HeaderSize, *end = data + size - sizeof(Padding);
+	Pixel index[64] = {};
+	Pixel px{0, 0, 0, 255};
+	int run = 0;
+	unsigned char *dst = image.data, *dstEnd = image.data + (size_t)width * height * channels;
+	for (; dst < dstEnd; dst += channels) {
+		if (run > 0) {
+			--run;
+		} else if (p < end) {
+			unsigned char b1 = *p++;
+			if (b1 == Op_Rgb) {
+				if (end - p < 3) {
+					return false;
+				}
+				px.r = p[0];
+				px.g = p[1];
+				px.b = p[2];
+				p += 3;
+			} else if (b1 == Op_Rgba) {
+				if (end - p < 4) {
+					return false;
+				}
+				px = Pixel{p[0], p[1], p[2], p[3]};
+				p += 4;
+			} else if ((b1 & Op_Mask) == Op_Index) {
+				px = index[b1];
+			} else if ((b1 & Op_Mask) == Op_Diff) {
+				px.r += ((b1 >> 4) & 3) - 2;
+				px.g += ((b1 >> 2) & 3) - 2;
+				px.b += (b1 & 3) - 2;
+			} else if ((b1 & Op_Mask) == Op_Luma) {
+				if (p == end) {
+					return false;
+				}
+				unsigned char b2 = *p++;
+				int vg = (b1 & 0x3f) - 32;
+				px.r += vg - 8 + ((b2 >> 4) & 0x0f);
+				px.g += vg;
+				px.b += vg - 8 + (b2 & 0x0f);
+			} else {
+				run = b1 & 0x3f;
+			}
+			index[px.hash()] = px;
+		} else {
+			return false;
+		}
+		dst[0] = px.r;
+		dst[1] = px.g;
+		dst[2] = px.b;
+		if (channels == 4) {
+			dst[3] = px.a;
+		}
+	}
+	return true;
+}
+
+std::vector<unsigned char> Qoi::encode(const unsigned char *data, int width, int height, int channels) {
+	if (width <= 0 || height <= 0 || (uint64_t)width * height > MaxPixels || channels < 1 || channels > 4) {
+		return {};
+	}
+	const int outChannels = channels == 2 || channels == 4 ? 4 : 3;
+	const size_t pixels = (size_t)width * height;
+	std::vector<unsigned char> out(HeaderSize + pixels * (outChannels + 1) + sizeof(Padding));
+	unsigned char *o = out.data();
+	memcpy(o, Magic, sizeof(Magic));
+	PutBigEndian(o + 4, (uint32_t)width);
+	PutBigEndian(o + 8, (uint32_t)height);
+	o[12] = (unsigned char)outChannels;
+	o[13] = 0;
+	o += HeaderSize;
+
+	Pixel index[64] = {};
+	Pixel prev{0, 0, 0, 255};
+	int run = 0;
+	const unsigned char *src = data;
+	for (size_t i = 0; i < pixels; ++i, src += channels) {
+		Pixel px;
+		if (channels <= 2) {
+			px = Pixel{src[0], src[0], src[0], channels == 2 ? src[1] : (unsigned char)255};
+		} else {
+			px = Pixel{src[0], src[1], src[2], channels == 4 ? src[3] : (unsigned char)255};
+		}
+		if (px == prev) {
+			if (++run == 62 || i + 1 == pixels) {
+				*o++ = (unsigned char)(Op_Run | (run - 1));
+				run = 0;
+			}
+			continue;
+		}
+		if (run > 0) {
+			*o++ = (unsigned char)(Op_Run | (run - 1));
+			run = 0;
+		}
+		int h = px.hash();
+		if (index[h] == px) {
+			*o++ = (unsigned char)(Op_Index | h);
+		} else if (index[h] = px, px.a == prev.a) {
+			signed char vr = (signed char)(px.r - prev.r), vg = (signed char)(px.g - prev.g),
+						vb = (signed char)(px.b - prev.b);
+			signed char vgr = (signed char)(vr - vg), vgb = (signed char)(vb - vg);
+			if (vr > -3 && vr < 2 && vg > -3 && vg < 2 && vb > -3 && vb < 2) {
+				*o++ = (unsigned char)(Op_Diff | (vr + 2) << 4 | (vg + 2) << 2 | (vb + 2));
+			} else if (vgr > -9 && vgr < 8 && vg > -33 && vg < 32 && vgb > -9 && vgb < 8) {
+				*o++ = (unsigned char)(Op_Luma | (vg + 32));
+				*o++ = (unsigned char)((vgr + 8) << 4 | (vgb + 8));
+			} else {
+				*o++ = Op_Rgb;
+				*o++ = px.r;
+				*o++ = px.g;
+				*o++ = px.b;
+			}
+		} else {
+			*o++ = Op_Rgba;
+			*o++ = px.r;
+			*o++ = px.g;
+			*o++ = px.b;
+			*o++ = px.a;
+		}
+		prev = px;
+	}
+	memcpy(o, Padding, sizeof(Padding));
+	o += sizeof(Padding);
+	out.resize(o - out.data());
+	return out;
+}
+
+bool Qoi::write(const char *filename, const unsigned char *data, int width, int height, int channels) {
+	std::vector<unsigned char> qoi = encode(data, width, height, channels);
+	if (qoi.empty()) {
+		return false;
+	}
+	std::FILE *file = fopen(filename, "wb");
+	if (file == nullptr) {
+		return false;
+	}
+	bool ok = fwrite(qoi.data(), 1, qoi.size(), file) == qoi.size();
+	return fclose(file) == 0 && ok;
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include "Image.hpp"
+
+#include <cstddef>
+#include <vector>
+
+// The Quite OK Image format: lossless, and simple enough to encode and decode in a single pass at close to memory
+// speed, which makes it the format for intermediate files. QOI stores RGB or RGBA; gray images are written as RGB
+// and gray with alpha as RGBA.
+namespace ayin::Qoi {
+bool is_qoi(const unsigned char *data, size_t size);
+// Reads only the header.
+bool info(const char *filename, int &width, int &height, int &channels);
+bool decode(const unsigned char *data, size_t size, Image &image);
+std::vector<unsigned char> encode(const unsigned char *data, int width, int height, int channels);
+bool write(const char *filename, const unsigned char *data, int width, int height, int channels);
+} // namespace ayin::Qoi
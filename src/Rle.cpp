@@ -0,0 +1,95 @@
+#include "Rle.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+using namespace ayin;
+
+static const size_t maxLiteral = 128;
+static const size_t minRun = 3;
+static const size_t maxRun = 130;
+
+std::vector<unsigned char> Rle::compress(const unsigned char *src, size_t size) {
+	std::vector<unsigned char> out(size + size / maxLiteral + 1);
+	unsigned char *dst = out.data();
+	size_t literalStart = 0;
+	size_t i = 0;
+
+	auto flushLiterals = [&](size_t end) {
+		while (literalStart < end) {
+			size_t n = std::min(end - literalStart, maxLiteral);
+			*dst++ = (unsigned char)(n - 1);
+			memcpy(dst, src + literalStart, n);
+			dst += n;
+			literalStart += n;
+		}
+	};
+
+	while (i < size) {
+		size_t run = 1;
+		while (i + run < size && run < maxRun && src[i + run] == src[i]) {
+			++run;
+		}
+		if (run >= minRun) {
+			flushLiterals(i);
+			*dst++ = (unsigned char)(run - minRun + 128);
+			*dst++ = src[i];
+			i += run;
+			literalStart = i;
+		} else {
+			i += run;
+		}
+	}
+	flushLiterals(size);
+
+	out.resize(dst - out.data());
+	out.shrink_to_fit();
+	return out;
+}
+
+template <bool Xor>
+static bool decode(const unsigned char *src, size_t srcSize, unsigned char *dst, size_t size) {
+	const unsigned char *end = src + srcSize;
+	unsigned char *dstEnd = dst + size;
+	while (src < end) {
+		unsigned char c = *src++;
+		if (c < 128) {
+			size_t n = (size_t)c + 1;
+			if ((size_t)(end - src) < n || (size_t)(dstEnd - dst) < n) {
+				return false;
+			}
+			if (Xor) {
+				for (size_t k = 0; k < n; ++k) {
+					dst[k] ^= src[k];
+				}
+			} else {
+				memcpy(dst, src, n);
+			}
+			src += n;
+			dst += n;
+		} else {
+			size_t n = (size_t)c - 128 + minRun;
+			if (src == end || (size_t)(dstEnd - dst) < n) {
+				return false;
+			}
+			unsigned char value = *src++;
+			if (!Xor) {
+				memset(dst, value, n);
+			} else if (value != 0) {
+				for (size_t k = 0; k < n; ++k) {
+					dst[k] ^= value;
+				}
+			}
+			dst += n;
+		}
+	}
+	return dst == dstEnd;
+}
+
+bool Rle::decompress(const unsigned char *src, size_t srcSize, unsigned char *dst, size_t size) {
+	return decode<false>(src, srcSize, dst, size);
+}
+
+bool Rle::decompress_xor(const unsigned char *src, size_t srcSize, unsigned char *dst, size_t size) {
+	return decode<true>(src, srcSize, dst, size);
+}
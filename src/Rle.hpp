@@ -0,0 +1,15 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+// Byte-oriented run-length coding (a PackBits variant). A control byte c < 128 is followed by c + 1 literal bytes;
+// a control byte c >= 128 is followed by one byte repeated c - 125 times. It is cheap enough to run at memory speed
+// and does well on XOR deltas, which are mostly runs of zeros.
+namespace ayin::Rle {
+std::vector<unsigned char> compress(const unsigned char *src, size_t size);
+// Decodes into dst, which must hold exactly size bytes. Returns false on malformed input.
+bool decompress(const unsigned char *src, size_t srcSize, unsigned char *dst, size_t size);
+// Like decompress, but XORs the decoded bytes into dst instead of overwriting it.
+bool decompress_xor(const unsigned char *src, size_t srcSize, unsigned char *dst, size_t size);
+} // namespace ayin::Rle
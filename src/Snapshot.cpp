@@ -0,0 +1,170 @@
+#include "Snapshot.hpp"
+#include "Rle.hpp"
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+
+using namespace ayin;
+
+size_t Snapshot::budget = AYIN_SNAPSHOT_BUDGET;
+size_t Snapshot::resident_budget = AYIN_SNAPSHOT_RESIDENT_BUDGET;
+
+// Guards the lists and sizes below, which every snapshot updates whichever thread creates, applies or destroys it.
+static std::mutex s_mutex;
+// Live snapshots from oldest to newest, and the sum of their sizes.
+static std::list<Snapshot *> s_snapshots{};
+static size_t s_totalSize = 0;
+// Snapshots held in RAM from least to most recently used.
+static std::list<Snapshot *> s_resident{};
+static size_t s_residentSize = 0;
+
+Snapshot::Snapshot(const Image &image, bool pinned)
+	: width(image.width), height(image.height), channels(image.channels), m_pinned(pinned) {
+	compress(image, nullptr);
+}
+
+Snapshot::Snapshot(const Image &image, const Image &base, bool pinned)
+	: width(image.width), height(image.height), channels(image.channels), m_delta(true), m_pinned(pinned) {
+	compress(image, &base);
+}
+
+Snapshot::~Snapshot() {
+	std::lock_guard<std::mutex> lock(s_mutex);
+	if (!m_evicted) {
+		evict();
+	}
+}
+
+void Snapshot::compress(const Image &image, const Image *base) {
+	size_t rowSize = (size_t)width * channels;
+	int tiles = (height + AYIN_SNAPSHOT_TILE_ROWS - 1) / AYIN_SNAPSHOT_TILE_ROWS;
+	std::vector<std::vector<unsigned char>> compressed(tiles);
+
+	ThreadPool::global().parallel_for(tiles, [&](int tile) {
+		int y = tile * AYIN_SNAPSHOT_TILE_ROWS;
+		size_t offset = y * rowSize;
+		size_t size = std::min(AYIN_SNAPSHOT_TILE_ROWS, height - y) * rowSize;
+		if (base == nullptr) {
+			compressed[tile] = Rle::compress(image.data + offset, size);
+			return;
+		}
+		std::vector<unsigned char> delta(size);
+		for (size_t i = 0; i < size; ++i) {
+			delta[i] = image.data[offset + i] ^ base->data[offset + i];
+		}
+		compressed[tile] = Rle::compress(delta.data(), size);
+	});
+
+	m_offsets.resize(tiles + 1);
+	for (int tile = 0; tile < tiles; ++tile) {
+		m_offsets[tile + 1] = m_offsets[tile] + compressed[tile].size();
+	}
+	m_size = m_offsets[tiles];
+	m_data.resize(m_size);
+	for (int tile = 0; tile < tiles; ++tile) {
+		std::copy(compressed[tile].begin(), compressed[tile].end(), m_data.begin() + m_offsets[tile]);
+	}
+
+	std::lock_guard<std::mutex> lock(s_mutex);
+	if (!m_pinned) {
+		s_totalSize += m_size;
+		m_entry = s_snapshots.insert(s_snapshots.end(), this);
+	}
+	s_residentSize += m_size;
+	m_residentEntry = s_resident.insert(s_resident.end(), this);
+
+	while (s_totalSize > budget && !s_snapshots.empty()) {
+		s_snapshots.front()->evict();
+	}
+	trim_resident();
+}
+
+void Snapshot::trim_resident() {
+	// Pinned snapshots that cannot be spilled move to the back, so each one is tried at most once.
+	for (size_t tries = s_resident.size(); s_residentSize > resident_budget && tries > 0; --tries) {
+		s_resident.front()->spill();
+	}
+}
+
+void Snapshot::spill() {
+	if (!m_file.create_temp(MappedFile::temp_directory(), m_data.data(), m_data.size())) {
+		if (m_pinned) {
+			s_resident.splice(s_resident.end(), s_resident, m_residentEntry);
+			return;
+		}
+		// Nowhere to put it, so drop it and let the owner recompute the state.
+		evict();
+		return;
+	}
+	s_residentSize -= m_size;
+	s_resident.erase(m_residentEntry);
+	m_data.clear();
+	m_data.shrink_to_fit();
+}
+
+void Snapshot::evict() {
+	if (!spilled()) {
+		s_residentSize -= m_size;
+		s_resident.erase(m_residentEntry);
+	}
+	if (!m_pinned) {
+		s_totalSize -= m_size;
+		s_snapshots.erase(m_entry);
+	}
+	m_data.clear();
+	m_data.shrink_to_fit();
+	m_offsets.clear();
+	m_file.close();
+	m_size = 0;
+	m_evicted = true;
+}
+
+bool Snapshot::apply(Image &image) {
+	// Held throughout, so that no other snapshot being created spills or evicts this one while it is read.
+	std::lock_guard<std::mutex> lock(s_mutex);
+	if (m_evicted || image.width != width || image.height != height || image.channels != channels) {
+		return false;
+	}
+	bool promote = spilled() && m_size <= resident_budget;
+	if (promote) {
+		// Used again, so it is one of the recent states the RAM budget is for: read it back from the spill file.
+		m_data.assign(m_file.data(), m_file.data() + m_size);
+		m_file.close();
+		s_residentSize += m_size;
+		m_residentEntry = s_resident.insert(s_resident.end(), this);
+	} else if (!spilled()) {
+		s_resident.splice(s_resident.end(), s_resident, m_residentEntry);
+	}
+	const unsigned char *data = spilled() ? m_file.data() : m_data.data();
+
+	size_t rowSize = (size_t)width * channels;
+	std::atomic<bool> ok = true;
+	ThreadPool::global().parallel_for((int)m_offsets.size() - 1, [&](int tile) {
+		int y = tile * AYIN_SNAPSHOT_TILE_ROWS;
+		unsigned char *dst = image.data + y * rowSize;
+		size_t size = std::min(AYIN_SNAPSHOT_TILE_ROWS, height - y) * rowSize;
+		const unsigned char *src = data + m_offsets[tile];
+		size_t srcSize = m_offsets[tile + 1] - m_offsets[tile];
+		bool tileOk = m_delta ? Rle::decompress_xor(src, srcSize, dst, size) : Rle::decompress(src, srcSize, dst, size);
+		if (!tileOk) {
+			ok = false;
+		}
+	});
+	if (promote) {
+		// After reading it, since this can spill the promoted snapshot again when pinned ones cannot be spilled.
+		trim_resident();
+	}
+	return ok;
+}
+
+size_t Snapshot::total_size() {
+	std::lock_guard<std::mutex> lock(s_mutex);
+	return s_totalSize;
+}
+
+size_t Snapshot::resident_size() {
+	std::lock_guard<std::mutex> lock(s_mutex);
+	return s_residentSize;
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include "Image.hpp"
+#include "MappedFile.hpp"
+
+#include <cstddef>
+#include <list>
+#include <vector>
+
+#ifndef AYIN_SNAPSHOT_BUDGET
+#define AYIN_SNAPSHOT_BUDGET ((size_t)4 * 1024 * 1024 * 1024)
+#endif
+
+// Snapshots beyond this many bytes in RAM are spilled to temporary files in the directory named by the AYIN_TMPDIR
+// environment variable (AYIN_MAPPEDFILE_TEMP_DIR_ENV), or else in the system temporary directory.
+#ifndef AYIN_SNAPSHOT_RESIDENT_BUDGET
+#define AYIN_SNAPSHOT_RESIDENT_BUDGET ((size_t)256 * 1024 * 1024)
+#endif
+
+#ifndef AYIN_SNAPSHOT_TILE_ROWS
+#define AYIN_SNAPSHOT_TILE_ROWS 64
+#endif
+
+namespace ayin {
+// Compressed pixels of one history state, stored either as a keyframe (the pixels themselves) or as a delta (the XOR
+// of two same-sized states). Tiles of AYIN_SNAPSHOT_TILE_ROWS rows are compressed independently and in parallel.
+//
+// All live snapshots share one byte budget; creating a snapshot that exceeds it evicts the oldest ones, which then
+// report evicted() and must be recomputed by the owner. Only the most recently used snapshots stay in RAM, within
+// resident_budget; the rest are spilled to memory-mapped temporary files in MappedFile::temp_directory(), and read back
+// into RAM when they are applied again.
+//
+// Pinned snapshots are never evicted and do not count against budget, only against resident_budget; if they cannot
+// be spilled they stay in RAM.
+//
+// The budget bookkeeping shared by all snapshots is guarded by a lock, so snapshots may be created, applied and
+// destroyed on any thread. A single snapshot is not to be used by two threads at once.
+class Snapshot {
+public:
+	int width = 0;
+	int height = 0;
+	int channels = 0;
+
+	explicit Snapshot(const Image &image, bool pinned = false);
+	Snapshot(const Image &image, const Image &base, bool pinned = false);
+	Snapshot(const Snapshot &) = delete;
+	Snapshot &operator=(const Snapshot &) = delete;
+	~Snapshot();
+
+	bool is_delta() const { return m_delta; }
+	bool evicted() const { return m_evicted; }
+	bool spilled() const { return m_file.is_open(); }
+	size_t size() const { return m_size; }
+
+	// For a delta, XORs it into image, turning either side of the pair into the other. For a keyframe, overwrites
+	// image with the stored pixels. The image must already have the snapshot's dimensions.
+	bool apply(Image &image);
+
+	static size_t total_size();
+	static size_t resident_size();
+	static size_t budget;
+	static size_t resident_budget;
+
+private:
+	std::vector<unsigned char> m_data{};
+	std::vector<size_t> m_offsets{};
+	MappedFile m_file{};
+	std::list<Snapshot *>::iterator m_entry{};
+	std::list<Snapshot *>::iterator m_residentEntry{};
+	size_t m_size = 0;
+	bool m_delta = false;
+	bool m_evicted = false;
+	bool m_pinned = false;
+
+	void compress(const Image &image, const Image *base);
+	void spill();
+	void evict();
+	// Spills the least recently used snapshots until the resident ones fit in resident_budget.
+	static void trim_resident();
+};
+} // namespace ayin
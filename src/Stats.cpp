@@ -0,0 +1,105 @@
+#include "Stats.hpp"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <mutex>
+
+#ifdef _WIN32
+#define PSAPI_VERSION 2
+#ifndef __MINGW32__
+#include <Windows.h>
+#else
+#include <windows.h>
+#endif // __MINGW32_
+#include <psapi.h>
+#else
+#include <unistd.h>
+#endif
+
+using namespace ayin;
+
+Stats::Timing Stats::undo{};
+Stats::Timing Stats::redo{};
+Stats::Timing Stats::preview{};
+size_t Stats::upload_bytes = 0;
+size_t Stats::last_upload_bytes = 0;
+double Stats::upload_time = 0.0;
+double Stats::last_upload_time = 0.0;
+float Stats::frame_times[AYIN_STATS_FRAME_HISTORY]{};
+int Stats::frame_times_offset = 0;
+int Stats::wakeups_per_second = 0;
+
+double Stats::now() {
+	using namespace std::chrono;
+	return duration<double, std::milli>(steady_clock::now().time_since_epoch()).count();
+}
+
+void Stats::Timing::add(double ms, double megapixels) {
+	last = ms;
+	total += ms;
+	++count;
+	last_megapixels = megapixels;
+	total_megapixels += megapixels;
+}
+
+static std::mutex s_inputMutex;
+static Stats::Input s_input;
+
+void Stats::add_input_read(size_t bytes, double ms) {
+	std::lock_guard lock(s_inputMutex);
+	s_input.bytes += bytes;
+	s_input.read.add(ms);
+}
+
+void Stats::add_input_decode(double ms, double megapixels) {
+	std::lock_guard lock(s_inputMutex);
+	s_input.decode.add(ms, megapixels);
+}
+
+Stats::Input Stats::input() {
+	std::lock_guard lock(s_inputMutex);
+	return s_input;
+}
+
+static double s_frameStart = 0.0;
+
+void Stats::begin_frame() { s_frameStart = now(); }
+
+void Stats::end_frame() {
+	last_upload_bytes = upload_bytes;
+	upload_bytes = 0;
+	last_upload_time = upload_time;
+	upload_time = 0.0;
+	frame_times[frame_times_offset] = (float)(now() - s_frameStart);
+	frame_times_offset = (frame_times_offset + 1) % AYIN_STATS_FRAME_HISTORY;
+
+	static double second = now();
+	static int frames = 0;
+	++frames;
+	double time = now();
+	if (time - second >= 1000.0) {
+		wakeups_per_second = (int)std::lround(frames * 1000.0 / (time - second));
+		second = time;
+		frames = 0;
+	}
+}
+
+size_t Stats::resident_size() {
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+		return counters.WorkingSetSize;
+	}
+	return 0;
+#else
+	FILE *file = fopen("/proc/self/statm", "r");
+	if (file == nullptr) {
+		return 0;
+	}
+	unsigned long size = 0, resident = 0;
+	int n = fscanf(file, "%lu %lu", &size, &resident);
+	fclose(file);
+	return n == 2 ? (size_t)resident * (size_t)sysconf(_SC_PAGESIZE) : 0;
+#endif
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstddef>
+
+#ifndef AYIN_STATS_FRAME_HISTORY
+// Number of frame times kept for the performance overlay's graph.
+#define AYIN_STATS_FRAME_HISTORY 120
+#endif
+
+namespace ayin::Stats {
+// Milliseconds on a monotonic clock.
+double now();
+
+struct Timing {
+	double last = 0.0;
+	double total = 0.0;
+	int count = 0;
+	// Megapixels processed, for operations that report them.
+	double last_megapixels = 0.0;
+	double total_megapixels = 0.0;
+
+	void add(double ms, double megapixels = 0.0);
+	double average() const { return count ? total / count : 0.0; }
+	double megapixels_per_second() const { return total > 0.0 ? total_megapixels / total * 1000.0 : 0.0; }
+};
+
+// Adds the time between its construction and destruction to a Timing.
+class Timer {
+public:
+	explicit Timer(Timing &timing) : m_timing(timing), m_start(now()) {}
+	~Timer() { m_timing.add(now() - m_start); }
+
+private:
+	Timing &m_timing;
+	double m_start;
+};
+
+extern Timing undo;
+extern Timing redo;
+// Computing command previews.
+extern Timing preview;
+
+// Bytes uploaded to textures, and the time spent issuing the uploads, during the current frame and the previous one.
+extern size_t upload_bytes;
+extern size_t last_upload_bytes;
+extern double upload_time;
+extern double last_upload_time;
+
+// Time from begin_frame() to end_frame() of the last frames, in milliseconds, oldest at frame_times_offset.
+extern float frame_times[AYIN_STATS_FRAME_HISTORY];
+extern int frame_times_offset;
+
+// Reading input files, which happens on worker threads as well: bytes read, time spent getting them into memory, and
+// time spent decoding them. Read through input(), which returns a consistent copy.
+struct Input {
+	size_t bytes = 0;
+	Timing read;
+	Timing decode;
+};
+void add_input_read(size_t bytes, double ms);
+void add_input_decode(double ms, double megapixels);
+Input input();
+
+// Main loop iterations (rendered frames) during the last full second.
+extern int wakeups_per_second;
+
+// Bracket the work of a frame, excluding the time the main loop sleeps.
+void begin_frame();
+void end_frame();
+
+// Resident set size of the process in bytes, or 0 where it cannot be queried.
+size_t resident_size();
+} // namespace ayin::Stats
@@ -0,0 +1,275 @@
+#include "TextureUpload.hpp"
+#include "Stats.hpp"
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_opengl.h>
+
+using namespace ayin;
+
+static PFNGLGENBUFFERSPROC genBuffers = nullptr;
+static PFNGLDELETEBUFFERSPROC deleteBuffers = nullptr;
+static PFNGLBINDBUFFERPROC bindBuffer = nullptr;
+static PFNGLBUFFERDATAPROC bufferData = nullptr;
+static PFNGLMAPBUFFERRANGEPROC mapBufferRange = nullptr;
+static PFNGLUNMAPBUFFERPROC unmapBuffer = nullptr;
+// Fences (GL 3.2) tell when the GPU is done reading a buffer. Without them every band respecifies the buffer's
+// storage instead, which lets the driver keep the old one for a transfer still in flight.
+static PFNGLFENCESYNCPROC fenceSync = nullptr;
+static PFNGLCLIENTWAITSYNCPROC clientWaitSync = nullptr;
+static PFNGLDELETESYNCPROC deleteSync = nullptr;
+
+static bool enabled = false;
+
+// Rows copied by one worker job when filling a buffer.
+static const int rowsPerJob = 64;
+
+namespace {
+// Copies a band into a mapped buffer, rowsPerJob rows at a time. Workers and the render thread claim the row groups in
+// turn, so the render thread finishes a band itself when the workers are busy with other jobs.
+struct Fill {
+	unsigned char *mapped;
+	const Image *image;
+	Rect rect;
+	int jobs;
+	std::atomic<int> next{0};
+	std::atomic<int> finished{0};
+	std::mutex mutex{};
+	std::condition_variable cv{};
+
+	void run() {
+		size_t rowSize = (size_t)rect.width * image->channels;
+		for (int job = next++; job < jobs; job = next++) {
+			int end = std::min(rect.height, (job + 1) * rowsPerJob);
+			for (int j = job * rowsPerJob; j < end; ++j) {
+				memcpy(mapped + j * rowSize, &(*image)(rect.x, rect.y + j, 0), rowSize);
+			}
+			if (++finished == jobs) {
+				std::lock_guard<std::mutex> lock(mutex);
+				cv.notify_all();
+			}
+		}
+	}
+
+	void wait() {
+		run();
+		std::unique_lock<std::mutex> lock(mutex);
+		cv.wait(lock, [this] { return finished == jobs; });
+	}
+};
+
+struct Buffer {
+	GLuint id = 0;
+	size_t capacity = 0;
+	// Set after the transfer out of the buffer was issued, until the buffer is used again.
+	GLsync fence = nullptr;
+};
+
+// A band whose buffer is being filled, and where it goes once it is.
+struct Band {
+	int buffer;
+	const Image *image;
+	Rect rect;
+	GLuint texture;
+	int x, y;
+	std::shared_ptr<Fill> fill;
+};
+} // namespace
+
+static Buffer buffers[AYIN_TEXTUREUPLOAD_BUFFERS];
+static int nextBuffer = 0;
+// Bands in the order they were mapped, which is also the order of their buffers in the ring.
+static std::deque<Band> pending{};
+
+void TextureUpload::init() {
+#ifndef IMGUI_IMPL_OPENGL_ES2
+	const char *version = (const char *)glGetString(GL_VERSION);
+	int major = 0;
+	if (version == nullptr || sscanf(version, "%d", &major) != 1 || major < 3) {
+		return;
+	}
+	genBuffers = (PFNGLGENBUFFERSPROC)SDL_GL_GetProcAddress("glGenBuffers");
+	deleteBuffers = (PFNGLDELETEBUFFERSPROC)SDL_GL_GetProcAddress("glDeleteBuffers");
+	bindBuffer = (PFNGLBINDBUFFERPROC)SDL_GL_GetProcAddress("glBindBuffer");
+	bufferData = (PFNGLBUFFERDATAPROC)SDL_GL_GetProcAddress("glBufferData");
+	mapBufferRange = (PFNGLMAPBUFFERRANGEPROC)SDL_GL_GetProcAddress("glMapBufferRange");
+	unmapBuffer = (PFNGLUNMAPBUFFERPROC)SDL_GL_GetProcAddress("glUnmapBuffer");
+	if (!genBuffers || !deleteBuffers || !bindBuffer || !bufferData || !mapBufferRange || !unmapBuffer) {
+		return;
+	}
+	fenceSync = (PFNGLFENCESYNCPROC)SDL_GL_GetProcAddress("glFenceSync");
+	clientWaitSync = (PFNGLCLIENTWAITSYNCPROC)SDL_GL_GetProcAddress("glClientWaitSync");
+	deleteSync = (PFNGLDELETESYNCPROC)SDL_GL_GetProcAddress("glDeleteSync");
+	if (!fenceSync || !clientWaitSync || !deleteSync) {
+		fenceSync = nullptr;
+	}
+	enabled = true;
+	for (Buffer &buffer : buffers) {
+		genBuffers(1, &buffer.id);
+		enabled = enabled && buffer.id != 0;
+	}
+#endif
+}
+
+void TextureUpload::shutdown() {
+	finish();
+	for (Buffer &buffer : buffers) {
+		if (buffer.fence != nullptr) {
+			deleteSync(buffer.fence);
+		}
+		if (buffer.id != 0) {
+			deleteBuffers(1, &buffer.id);
+		}
+		buffer = Buffer{};
+	}
+	enabled = false;
+}
+
+bool TextureUpload::streaming() { return enabled; }
+
+static GLenum Format(const Image &image) { return image.channels == 3 ? GL_RGB : GL_RGBA; }
+
+static void UploadDirect(const Image &image, Rect rect, int x, int y) {
+#ifdef IMGUI_IMPL_OPENGL_ES2
+	// No GL_UNPACK_ROW_LENGTH: upload row by row unless the rows are contiguous.
+	if (rect.x != 0 || rect.width != image.width) {
+		for (int j = 0; j < rect.height; ++j) {
+			glTexSubImage2D(GL_TEXTURE_2D, 0, x, y + j, rect.width, 1, Format(image), GL_UNSIGNED_BYTE,
+							&image(rect.x, rect.y + j, 0));
+		}
+		return;
+	}
+#else
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, image.width);
+#endif
+	glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, rect.width, rect.height, Format(image), GL_UNSIGNED_BYTE,
+					&image(rect.x, rect.y, 0));
+#ifndef IMGUI_IMPL_OPENGL_ES2
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+#endif
+}
+
+// Waits for the oldest pending band to be filled, then unmaps its buffer and issues the transfer, fenced so the
+// buffer is not mapped again before the GPU has read it.
+static void IssueOldest() {
+	Band band = std::move(pending.front());
+	pending.pop_front();
+	band.fill->wait();
+	Buffer &buffer = buffers[band.buffer];
+
+	GLint bound = 0;
+	glGetIntegerv(GL_TEXTURE_BINDING_2D, &bound);
+	glBindTexture(GL_TEXTURE_2D, band.texture);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	bindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer.id);
+	if (unmapBuffer(GL_PIXEL_UNPACK_BUFFER)) {
+		glTexSubImage2D(GL_TEXTURE_2D, 0, band.x, band.y, band.rect.width, band.rect.height, Format(*band.image),
+						GL_UNSIGNED_BYTE, nullptr);
+		if (fenceSync != nullptr) {
+			buffer.fence = fenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		}
+		bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	} else {
+		// The buffer's contents were lost (e.g. a mode switch).
+		bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		UploadDirect(*band.image, band.rect, band.x, band.y);
+	}
+	glBindTexture(GL_TEXTURE_2D, (GLuint)bound);
+}
+
+// Maps the next buffer of the ring and starts copying band into it on the workers. Returns false if no buffer could
+// be mapped, in which case nothing was queued.
+static bool QueueBand(const Image &image, Rect rect, int x, int y) {
+	if (pending.size() == AYIN_TEXTUREUPLOAD_BUFFERS) {
+		IssueOldest();
+	}
+	int index = nextBuffer;
+	Buffer &buffer = buffers[index];
+	size_t size = (size_t)rect.width * image.channels * rect.height;
+	GLbitfield access = GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT;
+	bindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer.id);
+	if (buffer.fence != nullptr) {
+		// Frames ago, usually, so this rarely waits.
+		while (clientWaitSync(buffer.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED) {
+		}
+		deleteSync(buffer.fence);
+		buffer.fence = nullptr;
+	}
+	if (fenceSync == nullptr || size > buffer.capacity) {
+		buffer.capacity = std::max(size, buffer.capacity);
+		bufferData(GL_PIXEL_UNPACK_BUFFER, buffer.capacity, nullptr, GL_STREAM_DRAW);
+	} else {
+		// The fence guarantees the GPU no longer reads the buffer.
+		access |= GL_MAP_UNSYNCHRONIZED_BIT;
+	}
+	auto *mapped = (unsigned char *)mapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, access);
+	bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	if (mapped == nullptr) {
+		return false;
+	}
+	nextBuffer = (nextBuffer + 1) % AYIN_TEXTUREUPLOAD_BUFFERS;
+
+	GLint texture = 0;
+	glGetIntegerv(GL_TEXTURE_BINDING_2D, &texture);
+	auto fill = std::make_shared<Fill>();
+	fill->mapped = mapped;
+	fill->image = &image;
+	fill->rect = rect;
+	fill->jobs = (rect.height + rowsPerJob - 1) / rowsPerJob;
+	size_t helpers = std::min(ThreadPool::global().size(), (size_t)fill->jobs);
+	for (size_t i = 0; i < helpers; ++i) {
+		ThreadPool::global().submit([fill] { fill->run(); });
+	}
+	pending.push_back(Band{index, &image, rect, (GLuint)texture, x, y, std::move(fill)});
+	return true;
+}
+
+void TextureUpload::upload(const Image &image, Rect rect) { upload(image, rect, rect.x, rect.y); }
+
+void TextureUpload::upload(const Image &image, Rect rect, int x, int y) {
+	Rect clipped = rect.intersect(Rect{0, 0, image.width, image.height});
+	if (clipped.empty()) {
+		return;
+	}
+	x += clipped.x - rect.x;
+	y += clipped.y - rect.y;
+	rect = clipped;
+	size_t rowSize = (size_t)rect.width * image.channels;
+	Stats::upload_bytes += rowSize * rect.height;
+	double start = Stats::now();
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	if (!enabled || rowSize * rect.height < AYIN_TEXTUREUPLOAD_MIN_SIZE) {
+		UploadDirect(image, rect, x, y);
+		Stats::upload_time += Stats::now() - start;
+		return;
+	}
+
+	int bandRows = (int)std::max<size_t>(1, AYIN_TEXTUREUPLOAD_TILE_SIZE / rowSize);
+	for (int j = 0; j < rect.height; j += bandRows) {
+		Rect band{rect.x, rect.y + j, rect.width, std::min(bandRows, rect.height - j)};
+		if (!QueueBand(image, band, x, y + j)) {
+			UploadDirect(image, band, x, y + j);
+		}
+	}
+	Stats::upload_time += Stats::now() - start;
+}
+
+void TextureUpload::finish() {
+	double start = Stats::now();
+	bool any = !pending.empty();
+	while (!pending.empty()) {
+		IssueOldest();
+	}
+	if (any) {
+		Stats::upload_time += Stats::now() - start;
+	}
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include "Image.hpp"
+
+#include <cstddef>
+
+#ifndef AYIN_TEXTUREUPLOAD_MIN_SIZE
+// Uploads smaller than this many bytes go straight from client memory.
+#define AYIN_TEXTUREUPLOAD_MIN_SIZE (256 * 1024)
+#endif
+
+#ifndef AYIN_TEXTUREUPLOAD_TILE_SIZE
+// Largest pixel buffer filled at once; bigger uploads are split into bands of rows.
+#define AYIN_TEXTUREUPLOAD_TILE_SIZE (8 * 1024 * 1024)
+#endif
+
+#ifndef AYIN_TEXTUREUPLOAD_BUFFERS
+// Pixel buffer objects used in turn: how many bands can be filled or on their way to the GPU at once.
+#define AYIN_TEXTUREUPLOAD_BUFFERS 4
+#endif
+
+// Streams pixels to textures through a ring of pixel buffer objects. upload() maps the next buffer, hands the copy of
+// the band into it to the workers and returns; the render thread goes on with the next band or tile while they copy.
+// A band's buffer is unmapped and its transfer issued once the ring wraps around to it or at finish(), so the workers
+// fill band N while the render thread transfers band N - 1. Each transfer is fenced, and its buffer is not mapped
+// again until the GPU has read it. Without buffer object support (GLES2, or a context older than GL 3.0) uploads are
+// direct.
+namespace ayin::TextureUpload {
+// Loads the buffer object entry points. Needs a current GL context.
+void init();
+// Issues the pending transfers and releases the buffers. Call before the GL context is destroyed.
+void shutdown();
+bool streaming();
+
+// Uploads rect of image into level 0 of the currently bound texture, which has the image's size and format.
+void upload(const Image &image, Rect rect);
+// Same, into the bound texture at x, y; for textures that hold only part of the image.
+void upload(const Image &image, Rect rect, int x, int y);
+// Waits for the bands still being copied and issues their transfers. The images passed to upload() must not change,
+// and their textures must not be drawn or deleted, until then; callers finish at the end of each batch of uploads.
+void finish();
+} // namespace ayin::TextureUpload
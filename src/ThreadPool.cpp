@@ -0,0 +1,102 @@
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
+using namespace ayin;
+
+ThreadPool::ThreadPool(unsigned int threads) {
+	if (threads == 0) {
+		threads = 1;
+	}
+	for (unsigned int i = 0; i < threads; ++i) {
+		m_workers.emplace_back(&ThreadPool::worker_loop, this);
+	}
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stop = true;
+	}
+	m_cv.notify_all();
+	for (auto &worker : m_workers) {
+		worker.join();
+	}
+}
+
+ThreadPool &ThreadPool::global() {
+	static ThreadPool pool;
+	return pool;
+}
+
+void ThreadPool::submit(std::function<void()> job) {
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_jobs.push_back(std::move(job));
+	}
+	m_cv.notify_one();
+}
+
+void ThreadPool::worker_loop() {
+	for (;;) {
+		std::function<void()> job;
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_cv.wait(lock, [this] { return m_stop || !m_jobs.empty(); });
+			if (m_stop && m_jobs.empty()) {
+				return;
+			}
+			job = std::move(m_jobs.front());
+			m_jobs.pop_front();
+		}
+		job();
+	}
+}
+
+namespace {
+struct ParallelFor {
+	const std::function<void(int)> *fn;
+	int count;
+	std::atomic<int> next{0};
+	std::atomic<int> finished{0};
+	std::mutex mutex{};
+	std::condition_variable cv{};
+
+	// Claims and runs indices until none are left.
+	void run() {
+		for (int i = next++; i < count; i = next++) {
+			(*fn)(i);
+			if (++finished == count) {
+				std::lock_guard<std::mutex> lock(mutex);
+				cv.notify_all();
+			}
+		}
+	}
+};
+} // namespace
+
+void ThreadPool::parallel_for(int count, const std::function<void(int)> &fn) {
+	if (count <= 0) {
+		return;
+	}
+	if (count == 1 || m_workers.size() <= 1) {
+		for (int i = 0; i < count; ++i) {
+			fn(i);
+		}
+		return;
+	}
+
+	auto state = std::make_shared<ParallelFor>();
+	state->fn = &fn;
+	state->count = count;
+	size_t helpers = std::min(m_workers.size(), (size_t)count - 1);
+	for (size_t i = 0; i < helpers; ++i) {
+		submit([state] { state->run(); });
+	}
+	state->run();
+
+	std::unique_lock<std::mutex> lock(state->mutex);
+	state->cv.wait(lock, [&] { return state->finished == count; });
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace ayin {
+class ThreadPool {
+public:
+	explicit ThreadPool(unsigned int threads = std::thread::hardware_concurrency());
+	~ThreadPool();
+
+	// Shared pool used by filters, codecs and the history.
+	static ThreadPool &global();
+
+	void submit(std::function<void()> job);
+	// Calls fn(i) for every i in [0, count) and returns once all calls finished. The calling thread takes part in
+	// the work and runs every index no worker has claimed, so it may be called from a worker, even when all the
+	// others are busy, without deadlocking the pool.
+	void parallel_for(int count, const std::function<void(int)> &fn);
+	size_t size() const { return m_workers.size(); }
+
+private:
+	std::vector<std::thread> m_workers{};
+	std::deque<std::function<void()>> m_jobs{};
+	std::mutex m_mutex{};
+	std::condition_variable m_cv{};
+	bool m_stop = false;
+
+	void worker_loop();
+};
+} // namespace ayin
@@ -0,0 +1,140 @@
+#include "TiledTexture.hpp"
+#include "TextureUpload.hpp"
+
+#include <algorithm>
+
+#include <SDL2/SDL_opengl.h>
+
+using namespace ayin;
+
+TiledTexture::~TiledTexture() { unload(); }
+
+int TiledTexture::tile_size() {
+	static int size = 0;
+	if (size == 0) {
+		GLint max = 0;
+		glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max);
+		// Room for the border on both sides.
+		size = max > 2 ? std::min(max - 2, AYIN_TILEDTEXTURE_TILE_SIZE) : AYIN_TILEDTEXTURE_TILE_SIZE;
+	}
+	return size;
+}
+
+Rect TiledTexture::tileRect(int column, int row) const {
+	int size = tile_size();
+	return Rect{column * size, row * size, size, size}.intersect(Rect{0, 0, m_width, m_height});
+}
+
+Rect TiledTexture::textureRect(int column, int row) const {
+	return tileRect(column, row).expand(1, 1).intersect(Rect{0, 0, m_width, m_height});
+}
+
+Rect TiledTexture::tileRange(Rect rect) const {
+	rect = rect.intersect(Rect{0, 0, m_width, m_height});
+	if (rect.empty()) {
+		return Rect{};
+	}
+	int size = tile_size();
+	int x0 = rect.x / size, y0 = rect.y / size;
+	int x1 = (rect.x + rect.width - 1) / size + 1, y1 = (rect.y + rect.height - 1) / size + 1;
+	return Rect{x0, y0, x1 - x0, y1 - y0};
+}
+
+void TiledTexture::invalidate() { invalidate(Rect{0, 0, m_width, m_height}); }
+
+void TiledTexture::invalidate(Rect rect) {
+	// Pixels next to a tile are also in its border.
+	Rect range = tileRange(rect.expand(1, 1));
+	for (int row = range.y; row < range.y + range.height; ++row) {
+		for (int column = range.x; column < range.x + range.width; ++column) {
+			Tile &tile = m_tiles[row * m_columns + column];
+			tile.stale = tile.stale.unite(rect.intersect(textureRect(column, row)));
+		}
+	}
+}
+
+void TiledTexture::update(const Image &image, Rect visible) {
+	if (image.width != m_width || image.height != m_height || image.channels != m_channels) {
+		unload();
+		int size = tile_size();
+		m_width = image.width;
+		m_height = image.height;
+		m_channels = image.channels;
+		m_columns = (m_width + size - 1) / size;
+		m_rows = (m_height + size - 1) / size;
+		m_tiles.assign((size_t)m_columns * m_rows, Tile{});
+	}
+
+	GLint format = m_channels == 3 ? GL_RGB : GL_RGBA;
+	Rect range = tileRange(visible);
+	for (int row = range.y; row < range.y + range.height; ++row) {
+		for (int column = range.x; column < range.x + range.width; ++column) {
+			Tile &tile = m_tiles[row * m_columns + column];
+			if (tile.texture != 0 && tile.stale.empty()) {
+				continue;
+			}
+			Rect rect = textureRect(column, row);
+			Rect upload = tile.stale;
+			if (tile.texture == 0) {
+				upload = rect;
+				glGenTextures(1, &tile.texture);
+				glBindTexture(GL_TEXTURE_2D, tile.texture);
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+				glTexImage2D(GL_TEXTURE_2D, 0, format, rect.width, rect.height, 0, format, GL_UNSIGNED_BYTE, nullptr);
+			} else {
+				glBindTexture(GL_TEXTURE_2D, tile.texture);
+			}
+			TextureUpload::upload(image, upload, upload.x - rect.x, upload.y - rect.y);
+			tile.stale = Rect{};
+		}
+	}
+	// The tiles' bands were copied while the next tiles were being set up.
+	TextureUpload::finish();
+}
+
+void TiledTexture::draw(ImDrawList *drawList, ImVec2 pos, ImVec2 scale, Rect visible) const {
+	Rect range = tileRange(visible);
+	for (int row = range.y; row < range.y + range.height; ++row) {
+		for (int column = range.x; column < range.x + range.width; ++column) {
+			const Tile &tile = m_tiles[row * m_columns + column];
+			if (tile.texture == 0) {
+				continue;
+			}
+			Rect rect = tileRect(column, row);
+			Rect texture = textureRect(column, row);
+			ImVec2 min(pos.x + rect.x * scale.x, pos.y + rect.y * scale.y);
+			ImVec2 max(pos.x + (rect.x + rect.width) * scale.x, pos.y + (rect.y + rect.height) * scale.y);
+			// Only the tile's own pixels; the border is there for filtering across the edge.
+			ImVec2 uv0((float)(rect.x - texture.x) / texture.width, (float)(rect.y - texture.y) / texture.height);
+			ImVec2 uv1((float)(rect.x + rect.width - texture.x) / texture.width,
+					   (float)(rect.y + rect.height - texture.y) / texture.height);
+			drawList->AddImage((ImTextureID)(intptr_t)tile.texture, min, max, uv0, uv1);
+		}
+	}
+}
+
+void TiledTexture::unload() {
+	for (Tile &tile : m_tiles) {
+		if (tile.texture != 0) {
+			glDeleteTextures(1, &tile.texture);
+			tile.texture = 0;
+		}
+		tile.stale = Rect{};
+	}
+}
+
+size_t TiledTexture::size() const {
+	size_t size = 0;
+	for (int row = 0; row < m_rows; ++row) {
+		for (int column = 0; column < m_columns; ++column) {
+			if (m_tiles[row * m_columns + column].texture != 0) {
+				Rect rect = textureRect(column, row);
+				size += (size_t)rect.width * rect.height * m_channels;
+			}
+		}
+	}
+	return size;
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "Image.hpp"
+
+#include <cstddef>
+#include <vector>
+
+#include <imgui.h>
+
+#ifndef AYIN_TILEDTEXTURE_TILE_SIZE
+// Side of a tile in pixels; lowered to fit GL_MAX_TEXTURE_SIZE, border included, on drivers with a smaller limit.
+#define AYIN_TILEDTEXTURE_TILE_SIZE 1024
+#endif
+
+namespace ayin {
+// An image displayed as a grid of textures, so it can exceed GL_MAX_TEXTURE_SIZE. Tiles are only created and
+// uploaded once they intersect the visible region; afterwards only their invalidated parts are uploaded again.
+//
+// Each tile's texture also holds a one pixel border of its neighbours' pixels, which is not drawn, so linear filtering
+// at the edge of a tile blends across it as it would in a single texture instead of leaving a seam.
+class TiledTexture {
+public:
+	TiledTexture() = default;
+	TiledTexture(const TiledTexture &) = delete;
+	TiledTexture &operator=(const TiledTexture &) = delete;
+	~TiledTexture();
+
+	void invalidate();
+	// Marks a region of the image, in its pixels, as changed.
+	void invalidate(Rect rect);
+
+	// Uploads the tiles of image intersecting visible that are missing or out of date. A change of the image's
+	// dimensions drops all tiles.
+	void update(const Image &image, Rect visible);
+	// Draws the uploaded tiles intersecting visible with the image's top-left corner at pos, scaled by scale.
+	void draw(ImDrawList *drawList, ImVec2 pos, ImVec2 scale, Rect visible) const;
+	void unload();
+	// Bytes held by the uploaded tiles.
+	size_t size() const;
+
+	static int tile_size();
+
+private:
+	struct Tile {
+		unsigned int texture = 0;
+		// Out of date part, in image pixels.
+		Rect stale{};
+	};
+
+	int m_width = 0;
+	int m_height = 0;
+	int m_channels = 0;
+	int m_columns = 0;
+	int m_rows = 0;
+	std::vector<Tile> m_tiles{};
+
+	Rect tileRect(int column, int row) const;
+	// tileRect with the border, as held by the tile's texture.
+	Rect textureRect(int column, int row) const;
+	// Range of tile columns and rows intersecting rect, as a rectangle in tile units.
+	Rect tileRange(Rect rect) const;
+};
+} // namespace ayin
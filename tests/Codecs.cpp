@@ -0,0 +1,126 @@
+// Every codec must give back the exact pixels it was given. PNGs are also decoded with stb_image, so the encoder is
+// checked against an independent decoder rather than only against our own. QOI has no gray formats, so gray pixels
+// must come back as RGB and gray with alpha as RGBA.
+
+#include "Image.hpp"
+#include "Png.hpp"
+#include "Pnm.hpp"
+#include "Qoi.hpp"
+
+#include <stb_image.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+using namespace ayin;
+
+static int failures = 0;
+
+static void Check(bool ok, const char *what, int width, int height, int channels, int level = -1) {
+	if (!ok) {
+		fprintf(stderr, "FAIL: %s on %dx%dx%d", what, width, height, channels);
+		if (level >= 0) {
+			fprintf(stderr, " at level %d", level);
+		}
+		fprintf(stderr, "\n");
+		++failures;
+	}
+}
+
+// The top half is noise, which defeats the filters and the matcher, and the bottom half a gradient with repeats,
+// which both have something to work on.
+static std::vector<unsigned char> Pixels(int width, int height, int channels) {
+	std::vector<unsigned char> pixels((size_t)width * height * channels);
+	unsigned int seed = 12345;
+	for (int y = 0; y < height; ++y) {
+		for (size_t i = 0; i < (size_t)width * channels; ++i) {
+			seed = seed * 1103515245 + 12345;
+			const unsigned char gradient = (unsigned char)(i / channels / 3 + y + i % channels * 64);
+			pixels[(size_t)y * width * channels + i] = y < height / 2 ? (unsigned char)(seed >> 16) : gradient;
+		}
+	}
+	return pixels;
+}
+
+static void PngRoundTrip(const std::vector<unsigned char> &pixels, int width, int height, int channels, int level) {
+	std::vector<unsigned char> png = Png::encode(pixels.data(), width, height, channels, level);
+	int w, h, n;
+	unsigned char *decoded = stbi_load_from_memory(png.data(), (int)png.size(), &w, &h, &n, 0);
+	Check(decoded != nullptr && w == width && h == height && n == channels &&
+			  memcmp(decoded, pixels.data(), pixels.size()) == 0,
+		  "PNG decoded by stb_image", width, height, channels, level);
+	stbi_image_free(decoded);
+
+	Image image;
+	std::FILE *file = std::tmpfile();
+	bool ok = file != nullptr && fwrite(png.data(), 1, png.size(), file) == png.size() &&
+			  fseek(file, 0, SEEK_SET) == 0 && Png::decode(file, image);
+	if (file != nullptr) {
+		fclose(file);
+	}
+	Check(ok && image.width == width && image.height == height && image.channels == channels &&
+			  memcmp(image.data, pixels.data(), pixels.size()) == 0,
+		  "PNG decoded by Png::decode", width, height, channels, level);
+}
+
+static void QoiRoundTrip(const std::vector<unsigned char> &pixels, int width, int height, int channels) {
+	std::vector<unsigned char> qoi = Qoi::encode(pixels.data(), width, height, channels);
+	const int outChannels = channels == 2 || channels == 4 ? 4 : 3;
+	std::vector<unsigned char> expected((size_t)width * height * outChannels);
+	for (size_t i = 0; i < (size_t)width * height; ++i) {
+		const unsigned char *src = &pixels[i * channels];
+		unsigned char *dst = &expected[i * outChannels];
+		if (channels <= 2) {
+			dst[0] = dst[1] = dst[2] = src[0];
+			if (channels == 2) {
+				dst[3] = src[1];
+			}
+		} else {
+			memcpy(dst, src, channels);
+		}
+	}
+	Image image;
+	Check(Qoi::is_qoi(qoi.data(), qoi.size()) && Qoi::decode(qoi.data(), qoi.size(), image) && image.width == width &&
+			  image.height == height && image.channels == outChannels &&
+			  memcmp(image.data, expected.data(), expected.size()) == 0,
+		  "QOI", width, height, channels);
+}
+
+static void PnmRoundTrip(const std::vector<unsigned char> &pixels, int width, int height, int channels, bool pam) {
+	const std::string filename = (std::filesystem::temp_directory_path() / "ayin-test-codecs.pnm").string();
+	Image image;
+	bool ok = Pnm::write(filename.c_str(), pixels.data(), width, height, channels, pam);
+	std::FILE *file = ok ? fopen(filename.c_str(), "rb") : nullptr;
+	ok = file != nullptr && Pnm::decode(file, image);
+	if (file != nullptr) {
+		fclose(file);
+	}
+	remove(filename.c_str());
+	Check(ok && image.width == width && image.height == height && image.channels == channels &&
+			  memcmp(image.data, pixels.data(), pixels.size()) == 0,
+		  pam ? "PAM" : "PNM", width, height, channels);
+}
+
+int main() {
+	// 700x500 RGBA spans two strips of the encoder.
+	const int sizes[][2] = {{1, 1}, {7, 5}, {5, 7}, {64, 64}, {129, 33}, {700, 500}};
+	for (const auto &size : sizes) {
+		for (int channels = 1; channels <= 4; ++channels) {
+			std::vector<unsigned char> pixels = Pixels(size[0], size[1], channels);
+			for (int level = 0; level <= 9; ++level) {
+				PngRoundTrip(pixels, size[0], size[1], channels, level);
+			}
+			QoiRoundTrip(pixels, size[0], size[1], channels);
+			PnmRoundTrip(pixels, size[0], size[1], channels, false);
+			PnmRoundTrip(pixels, size[0], size[1], channels, true);
+		}
+	}
+	if (failures == 0) {
+		printf("Codecs: all round trips exact\n");
+	}
+	return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
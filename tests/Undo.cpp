@@ -0,0 +1,76 @@
+// Undoing and redoing the commands that have an exact inverse must restore the image bit for bit, and must do so by
+// applying the inverse rather than by replaying the history from the original.
+
+#include "Commands.hpp"
+#include "Image.hpp"
+#include "Photo.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+using namespace ayin;
+
+static int failures = 0;
+
+static bool Same(const Image &a, const Image &b) {
+	return a.width == b.width && a.height == b.height && a.channels == b.channels &&
+		   memcmp(a.data, b.data, (size_t)a.width * a.height * a.channels) == 0;
+}
+
+static void Check(bool ok, const char *what, const Commands::Info &info, int width, int height, int channels) {
+	if (!ok) {
+		fprintf(stderr, "FAIL: %s of %s (turns %d) on %dx%dx%d\n", what, Commands::names[info.ty],
+				info.ty == Commands::Type_Rotate ? info.rotate_turns : 0, width, height, channels);
+		++failures;
+	}
+}
+
+static void RoundTrip(const Commands::Info &info, int width, int height, int channels) {
+	Image *image = new Image(width, height, channels);
+	unsigned int seed = 12345;
+	for (size_t i = 0; i < (size_t)width * height * channels; ++i) {
+		seed = seed * 1103515245 + 12345;
+		image->data[i] = (unsigned char)(seed >> 16);
+	}
+	Photo photo;
+	photo.finish_loading(image, 0.0);
+	Image before(*photo.image);
+	// Invert every byte of the original, so that a replay from it cannot produce the expected image by accident.
+	for (size_t i = 0; i < (size_t)width * height * channels; ++i) {
+		photo.origImage->data[i] = (unsigned char)~photo.origImage->data[i];
+	}
+
+	photo.begin_change(info.ty);
+	Commands::apply(*photo.image, info);
+	photo.push_change(info);
+	Image after(*photo.image);
+	Check(photo.history_size() == 0, "snapshot taken", info, width, height, channels);
+
+	photo.undo_change();
+	Check(Same(*photo.image, before), "undo", info, width, height, channels);
+	photo.redo_change();
+	Check(Same(*photo.image, after), "redo", info, width, height, channels);
+}
+
+int main() {
+	const Commands::Info commands[] = {
+		Commands::Info(Commands::Type_Invert),
+		Commands::Info(Commands::Type_FlipHorizontally),
+		Commands::Info(Commands::Type_FlipVertically),
+		Commands::Info(Commands::Type_Rotate, 1),
+		Commands::Info(Commands::Type_Rotate, -1),
+	};
+	const int sizes[][2] = {{1, 1}, {7, 5}, {5, 7}, {64, 64}, {129, 33}};
+	for (const Commands::Info &info : commands) {
+		for (const auto &size : sizes) {
+			for (int channels : {3, 4}) {
+				RoundTrip(info, size[0], size[1], channels);
+			}
+		}
+	}
+	if (failures == 0) {
+		printf("Undo: all round trips exact\n");
+	}
+	return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}